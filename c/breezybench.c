@@ -0,0 +1,403 @@
+/*
+
+breezybench.c : microbenchmarks for the hot paths of the C core: distance_scan_to_map
+(each kernel), map_update, scan_update (with and without interpolation), and
+rmhc_position_search, over several map sizes, scan sizes, and spans.
+
+Scans are simulated in a rectangular room (see breezysim.h), so every run sees the same data.  Each
+benchmark is timed over several runs, each long enough for the clock; results are
+printed one JSON object per line, for comparing builds:
+
+    {"bench": "map_update", "kernel": "avx2", "map_pixels": 800, "scan_size": 682, "span": 3,
+     "ns_per_op": ..., "stddev_ns": ..., "min_ns": ..., "points_per_sec": ..., "runs": 5, "ops_per_run": ...}
+
+Usage: breezybench [name] [runs], where name picks the benchmarks whose names contain it.
+
+Copyright (C) 2014 Simon D. Levy
+
+This code is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this code.  If not, see <http:#www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "coreslam.h"
+#include "random.h"
+#include "breezysim.h"
+
+/* Benchmark parameters ----------------------------------------------------- */
+
+static const int    MAP_SIZES_PIXELS[]  = {400, 800, 2000, 4000};
+
+/* scan size and detection angle of some common lidars */
+static const int    SCAN_SIZES[]        = {360, 682, 1080};
+static const double SCAN_ANGLES[]       = {360, 240, 270};
+
+static const int    SPANS[]             = {1, 3};
+
+static const char * KERNELS[]           = {"sisd", "sse", "avx2", "avx512", "neon"};
+
+/* each timed run is at least this long */
+static const double MIN_RUN_NS          = 1e7;
+
+static const int    DEFAULT_RUNS        = 5;
+
+#define NELEMS(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+/* Timing ------------------------------------------------------------------- */
+
+typedef void (*op_t)(void * arg);
+
+typedef struct stats_t
+{
+    double mean_ns;
+    double stddev_ns;
+    double min_ns;
+    int runs;
+    long ops_per_run;
+
+} stats_t;
+
+/* sink for results, so that the compiler keeps the work */
+static volatile int sink;
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+time_ops(
+    op_t op,
+    void * arg,
+    long nops)
+{
+    double start = now_ns();
+
+    long k = 0;
+    for (k=0; k<nops; ++k)
+    {
+        op(arg);
+    }
+
+    return now_ns() - start;
+}
+
+static stats_t
+time_op(
+    op_t op,
+    void * arg,
+    int runs)
+{
+    stats_t stats;
+
+    /* warm up, and find how many ops make a run long enough */
+    long nops = 1;
+    while (time_ops(op, arg, nops) < MIN_RUN_NS)
+    {
+        nops *= 2;
+    }
+
+    double sum = 0, sumsq = 0, min = 0;
+
+    int k = 0;
+    for (k=0; k<runs; ++k)
+    {
+        double ns = time_ops(op, arg, nops) / nops;
+
+        sum += ns;
+        sumsq += ns * ns;
+        min = (k == 0 || ns < min) ? ns : min;
+    }
+
+    stats.mean_ns = sum / runs;
+    stats.stddev_ns = runs > 1 ? sqrt((sumsq - sum * sum / runs) / (runs - 1)) : 0;
+    stats.min_ns = min;
+    stats.runs = runs;
+    stats.ops_per_run = nops;
+
+    return stats;
+}
+
+static void
+report(
+    const char * bench,
+    int map_pixels,
+    int scan_size,
+    int span,
+    int points_per_op,
+    stats_t stats)
+{
+    printf("{\"bench\": \"%s\", \"kernel\": \"%s\", \"map_pixels\": %d, \"scan_size\": %d, \"span\": %d, "
+           "\"ns_per_op\": %.1f, \"stddev_ns\": %.1f, \"min_ns\": %.1f, \"points_per_sec\": %.0f, "
+           "\"runs\": %d, \"ops_per_run\": %ld}\n",
+           bench, distance_scan_to_map_kernel(), map_pixels, scan_size, span,
+           stats.mean_ns, stats.stddev_ns, stats.min_ns, points_per_op * 1e9 / stats.mean_ns,
+           stats.runs, stats.ops_per_run);
+
+    fflush(stdout);
+}
+
+/* Operations timed --------------------------------------------------------- */
+
+typedef struct op_arg_t
+{
+    map_t * map;
+    scan_t * scan;
+    position_t position;
+
+    int * distances_mm;
+    float * angles_deg;
+    int scan_size;
+
+    void * randomizer;
+
+} op_arg_t;
+
+static void
+op_distance_scan_to_map(void * v)
+{
+    op_arg_t * arg = (op_arg_t *)v;
+    sink = distance_scan_to_map(arg->map, arg->scan, arg->position);
+}
+
+static void
+op_map_update(void * v)
+{
+    op_arg_t * arg = (op_arg_t *)v;
+    map_update(arg->map, arg->scan, arg->position, DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM);
+}
+
+static void
+op_scan_update(void * v)
+{
+    op_arg_t * arg = (op_arg_t *)v;
+    scan_update(arg->scan, arg->angles_deg, arg->distances_mm, arg->scan_size, DEFAULT_HOLE_WIDTH_MM, 0, 0);
+}
+
+static void
+op_rmhc_position_search(void * v)
+{
+    op_arg_t * arg = (op_arg_t *)v;
+
+    /* same search every time */
+    random_init(arg->randomizer, 9999);
+
+    position_t position = rmhc_position_search(arg->position, arg->map, arg->scan,
+        DEFAULT_SIGMA_XY_MM, DEFAULT_SIGMA_THETA_DEGREES, DEFAULT_MAX_SEARCH_ITER, arg->randomizer);
+
+    sink = (int)position.x_mm;
+}
+
+/* Benchmarks --------------------------------------------------------------- */
+
+static void
+bench_distance_scan_to_map(
+    int runs)
+{
+    int k = 0;
+    for (k=0; k<NELEMS(KERNELS); ++k)
+    {
+        if (distance_scan_to_map_select(KERNELS[k]))
+        {
+            continue;
+        }
+
+        int m = 0;
+        for (m=0; m<NELEMS(MAP_SIZES_PIXELS); ++m)
+        {
+            int s = 0;
+            for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+            {
+                map_t map;
+                make_map(&map, 0, MAP_SIZES_PIXELS[m], SCAN_SIZES[s], SCAN_ANGLES[s]);
+
+                int p = 0;
+                for (p=0; p<NELEMS(SPANS); ++p)
+                {
+                    scan_t scan;
+                    make_scan(&scan, SPANS[p], SCAN_SIZES[s], SCAN_ANGLES[s], MAP_SCANS);
+
+                    op_arg_t arg;
+                    arg.map = &map;
+                    arg.scan = &scan;
+                    arg.position = path_position(MAP_SCANS);
+
+                    stats_t stats = time_op(op_distance_scan_to_map, &arg, runs);
+                    report("distance_scan_to_map", MAP_SIZES_PIXELS[m], SCAN_SIZES[s], SPANS[p],
+                           scan.obst_npoints, stats);
+
+                    scan_free(&scan);
+                }
+
+                map_free(&map);
+            }
+        }
+    }
+}
+
+static void
+bench_map_update(
+    int runs)
+{
+    int m = 0;
+    for (m=0; m<NELEMS(MAP_SIZES_PIXELS); ++m)
+    {
+        int s = 0;
+        for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+        {
+            int p = 0;
+            for (p=0; p<NELEMS(SPANS); ++p)
+            {
+                map_t map;
+                make_map(&map, 0, MAP_SIZES_PIXELS[m], SCAN_SIZES[s], SCAN_ANGLES[s]);
+
+                scan_t scan;
+                make_scan(&scan, SPANS[p], SCAN_SIZES[s], SCAN_ANGLES[s], MAP_SCANS);
+
+                op_arg_t arg;
+                arg.map = &map;
+                arg.scan = &scan;
+                arg.position = path_position(MAP_SCANS);
+
+                stats_t stats = time_op(op_map_update, &arg, runs);
+                report("map_update", MAP_SIZES_PIXELS[m], SCAN_SIZES[s], SPANS[p], scan.npoints, stats);
+
+                scan_free(&scan);
+                map_free(&map);
+            }
+        }
+    }
+}
+
+static void
+bench_scan_update(
+    const char * name,
+    int interpolate,
+    int runs)
+{
+    int s = 0;
+    for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+    {
+        int p = 0;
+        for (p=0; p<NELEMS(SPANS); ++p)
+        {
+            scan_t scan;
+            scan_init(&scan, SPANS[p], SCAN_SIZES[s], SCAN_RATE_HZ, SCAN_ANGLES[s], NO_DETECTION_MM, 0, 0);
+
+            op_arg_t arg;
+            arg.scan = &scan;
+            arg.scan_size = SCAN_SIZES[s];
+            arg.distances_mm = int_alloc(SCAN_SIZES[s]);
+            arg.angles_deg = interpolate ? float_alloc(SCAN_SIZES[s]) : NULL;
+
+            simulate_scan(arg.distances_mm, arg.angles_deg, SCAN_SIZES[s], SCAN_ANGLES[s], 0, 0, 0, 1);
+
+            stats_t stats = time_op(op_scan_update, &arg, runs);
+            report(name, 0, SCAN_SIZES[s], SPANS[p], SCAN_SIZES[s], stats);
+
+            free(arg.distances_mm);
+            free(arg.angles_deg);
+            scan_free(&scan);
+        }
+    }
+}
+
+static void
+bench_rmhc_position_search(
+    int runs)
+{
+    int m = 0;
+    for (m=0; m<NELEMS(MAP_SIZES_PIXELS); ++m)
+    {
+        int s = 0;
+        for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+        {
+            map_t map;
+            make_map(&map, 0, MAP_SIZES_PIXELS[m], SCAN_SIZES[s], SCAN_ANGLES[s]);
+
+            scan_t scan;
+            make_scan(&scan, 1, SCAN_SIZES[s], SCAN_ANGLES[s], MAP_SCANS);
+
+            op_arg_t arg;
+            arg.map = &map;
+            arg.scan = &scan;
+            arg.randomizer = random_new(9999);
+
+            /* start a little away from the true position */
+            arg.position = path_position(MAP_SCANS);
+            arg.position.x_mm += 50;
+            arg.position.theta_degrees += 1;
+
+            stats_t stats = time_op(op_rmhc_position_search, &arg, runs);
+            report("rmhc_position_search", MAP_SIZES_PIXELS[m], SCAN_SIZES[s], 1, scan.obst_npoints, stats);
+
+            random_free(arg.randomizer);
+            scan_free(&scan);
+            map_free(&map);
+        }
+    }
+}
+
+int
+main(
+    int argc,
+    char ** argv)
+{
+    const char * name = argc > 1 ? argv[1] : "";
+    int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+
+    if (runs < 1)
+    {
+        fprintf(stderr, "Usage: %s [name] [runs]\n", argv[0]);
+        exit(1);
+    }
+
+    /* restored after each kernel benchmark */
+    const char * default_kernel = distance_scan_to_map_kernel();
+
+    if (strstr("distance_scan_to_map", name))
+    {
+        bench_distance_scan_to_map(runs);
+        distance_scan_to_map_select(default_kernel);
+    }
+
+    if (strstr("map_update", name))
+    {
+        bench_map_update(runs);
+    }
+
+    if (strstr("scan_update", name))
+    {
+        bench_scan_update("scan_update", 0, runs);
+    }
+
+    if (strstr("scan_update_interpolated", name))
+    {
+        bench_scan_update("scan_update_interpolated", 1, runs);
+    }
+
+    if (strstr("rmhc_position_search", name))
+    {
+        bench_rmhc_position_search(runs);
+    }
+
+    return 0;
+}
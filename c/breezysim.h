@@ -0,0 +1,163 @@
+/*
+
+breezysim.h : scans and maps simulated in a rectangular room, shared by breezybench and
+breezytest so that every run of either sees the same data.
+
+The robot follows a short straight path from the center of the map, turning as it goes;
+each scan measures the walls of the room with a little deterministic noise.
+
+Copyright (C) 2014 Simon D. Levy
+
+This code is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this code.  If not, see <http:#www.gnu.org/licenses/>.
+*/
+
+static const double MAP_SIZE_METERS     = 32;
+
+static const double SCAN_RATE_HZ        = 10;
+static const double NO_DETECTION_MM     = 10000;
+
+/* half-sizes of the simulated room */
+static const double ROOM_X_MM           = 6000;
+static const double ROOM_Y_MM           = 4000;
+
+/* scans put into each map, along a short path */
+static const int    MAP_SCANS           = 20;
+
+/* Distance from (x_mm, y_mm) to the walls of the room along angle_degrees, with a little
+   noise from seed; 0 (no detection) beyond the range of the lidar */
+static inline int
+room_distance(
+    double x_mm,
+    double y_mm,
+    double angle_degrees,
+    unsigned * seed)
+{
+    double c = cos(angle_degrees * M_PI / 180);
+    double s = sin(angle_degrees * M_PI / 180);
+
+    double tx = fabs(c) > 1e-9 ? ((c > 0 ? ROOM_X_MM : -ROOM_X_MM) - x_mm) / c : 1e12;
+    double ty = fabs(s) > 1e-9 ? ((s > 0 ? ROOM_Y_MM : -ROOM_Y_MM) - y_mm) / s : 1e12;
+    double d = tx < ty ? tx : ty;
+
+    *seed = *seed * 1103515245 + 12345;
+    d += (int)((*seed >> 16) % 21) - 10;
+
+    return d < NO_DETECTION_MM ? (int)d : 0;
+}
+
+/* Simulates a scan of scan_size rays over detection_angle_degrees from (x_mm, y_mm) in the
+   room; if angles_deg is not NULL, also gives the rays uneven angles there, as for a lidar
+   that needs interpolation */
+static inline void
+simulate_scan(
+    int * distances_mm,
+    float * angles_deg,
+    int scan_size,
+    double detection_angle_degrees,
+    double x_mm,
+    double y_mm,
+    double theta_degrees,
+    unsigned seed)
+{
+    int k = 0;
+    for (k=0; k<scan_size; ++k)
+    {
+        double angle = -detection_angle_degrees / 2 + k * detection_angle_degrees / (scan_size - 1);
+
+        if (angles_deg)
+        {
+            seed = seed * 1103515245 + 12345;
+            angle += ((int)((seed >> 16) % 100) - 50) * 0.002;
+            angles_deg[k] = angle;
+        }
+
+        distances_mm[k] = room_distance(x_mm, y_mm, theta_degrees + angle, &seed);
+    }
+}
+
+/* Position of the robot at step k of its path, in map coordinates */
+static inline position_t
+path_position(
+    int k)
+{
+    position_t position;
+
+    position.x_mm = MAP_SIZE_METERS * 500 + 50 * k;
+    position.y_mm = MAP_SIZE_METERS * 500 + 20 * k;
+    position.theta_degrees = 2 * k;
+
+    return position;
+}
+
+/* Simulates the lidar distances seen at step k of the path */
+static inline void
+simulate_path_scan(
+    int * distances_mm,
+    int scan_size,
+    double detection_angle_degrees,
+    int step)
+{
+    /* room coordinates are relative to the map center */
+    position_t position = path_position(step);
+    simulate_scan(distances_mm, NULL, scan_size, detection_angle_degrees,
+                  position.x_mm - MAP_SIZE_METERS * 500, position.y_mm - MAP_SIZE_METERS * 500,
+                  position.theta_degrees, step);
+}
+
+static inline void
+make_scan(
+    scan_t * scan,
+    int span,
+    int scan_size,
+    double detection_angle_degrees,
+    int step)
+{
+    int * distances_mm = int_alloc(scan_size);
+
+    scan_init(scan, span, scan_size, SCAN_RATE_HZ, detection_angle_degrees, NO_DETECTION_MM, 0, 0);
+
+    simulate_path_scan(distances_mm, scan_size, detection_angle_degrees, step);
+
+    scan_update(scan, NULL, distances_mm, scan_size, DEFAULT_HOLE_WIDTH_MM, 0, 0);
+
+    free(distances_mm);
+}
+
+/* Builds a map, dense or sparse, from the first MAP_SCANS scans of the path */
+static inline void
+make_map(
+    map_t * map,
+    int sparse,
+    int size_pixels,
+    int scan_size,
+    double detection_angle_degrees)
+{
+    if (sparse)
+    {
+        map_init_sparse(map, size_pixels, MAP_SIZE_METERS);
+    }
+    else
+    {
+        map_init(map, size_pixels, MAP_SIZE_METERS);
+    }
+
+    int k = 0;
+    for (k=0; k<MAP_SCANS; ++k)
+    {
+        scan_t scan;
+        make_scan(&scan, 3, scan_size, detection_angle_degrees, k);
+        map_update(map, &scan, path_position(k), DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM);
+        scan_free(&scan);
+    }
+}
@@ -0,0 +1,825 @@
+/*
+
+breezytest.c : checks that the faster paths of the C core give the results they promise, on
+the simulated room of breezybench (see breezysim.h):
+
+  - map_update_rings over ring bounds, in any order, gives exactly the map of map_update
+  - sparse maps hold exactly the pixels, pyramid, and tile versions of dense ones
+  - map_get_tiles returns every tile that changed, with the pixels of map_get
+  - batch, bounded, and pyramid-level scoring agree with distance_scan_to_map, stratified
+    obstacle points are the obstacles of the scan, and the SIMD kernels stay within
+    KERNEL_TOLERANCE of the sisd kernel
+  - scan_update_multiple gives the scans that scan_update would
+  - maps saved by map_save open in every mode with the same pixels, and bad files are refused
+  - RMHC searches from pre-rotated bins do not depend on what earlier searches left cached
+
+Prints each failure, then a summary; exits with status 1 if any check failed.  The reports the
+core prints on stderr for the read-only map and the bad map files it is given are expected.
+
+Usage: breezytest
+
+Copyright (C) 2014 Simon D. Levy
+
+This code is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this code.  If not, see <http:#www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+
+#include "coreslam.h"
+#include "coreslam_internals.h"
+#include "random.h"
+#include "breezysim.h"
+
+/* Test parameters ---------------------------------------------------------- */
+
+static const int    MAP_SIZE_PIXELS     = 800;
+
+/* scan size and detection angle of some common lidars */
+static const int    SCAN_SIZES[]        = {360, 682, 1080};
+static const double SCAN_ANGLES[]       = {360, 240, 270};
+
+static const char * KERNELS[]           = {"sisd", "sse", "avx2", "avx512", "neon"};
+
+/* The SIMD kernels compute point coordinates in single precision, so a point near a pixel
+   boundary can round to its neighbor; their distances may differ from sisd by this fraction */
+static const double KERNEL_TOLERANCE    = 0.005;
+
+static const int    PYRAMID_LEVELS      = 2;
+
+static const char * MAP_FILE            = "breezytest.map";
+
+#define NELEMS(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+/* Checks ------------------------------------------------------------------- */
+
+static int nchecks;
+static int nfailures;
+
+/* Counts a check, printing what failed if ok is zero */
+static void
+check(
+    int ok,
+    const char * format,
+    ...)
+{
+    nchecks++;
+
+    if (!ok)
+    {
+        va_list args;
+        va_start(args, format);
+        printf("FAIL: ");
+        vprintf(format, args);
+        printf("\n");
+        va_end(args);
+
+        nfailures++;
+    }
+}
+
+/* Returns the number of pixels that differ between two maps of the same size */
+static int
+pixels_differing(
+    map_t * a,
+    map_t * b)
+{
+    int ndiffer = 0;
+
+    int y = 0;
+    for (y=0; y<a->size_pixels; ++y)
+    {
+        int x = 0;
+        for (x=0; x<a->size_pixels; ++x)
+        {
+            ndiffer += map_pixel(a, x, y) != map_pixel(b, x, y);
+        }
+    }
+
+    return ndiffer;
+}
+
+/* Checks that two maps have the same pixels, pyramid, version, and tile versions */
+static void
+check_same_maps(
+    map_t * a,
+    map_t * b,
+    const char * what)
+{
+    check(a->size_pixels == b->size_pixels, "%s: sizes %d, %d", what, a->size_pixels, b->size_pixels);
+
+    if (a->size_pixels != b->size_pixels)
+    {
+        return;
+    }
+
+    int ndiffer = pixels_differing(a, b);
+    check(ndiffer == 0, "%s: %d pixels differ", what, ndiffer);
+
+    check(a->version == b->version, "%s: versions %u, %u", what, a->version, b->version);
+
+    int ntiles = a->size_tiles * a->size_tiles;
+    check(!memcmp(a->tile_versions, b->tile_versions, ntiles * sizeof(unsigned)), "%s: tile versions differ", what);
+
+    check(a->pyramid_levels == b->pyramid_levels, "%s: pyramid levels %d, %d", what,
+          a->pyramid_levels, b->pyramid_levels);
+
+    int level = 0;
+    for (level=0; level<a->pyramid_levels && level<b->pyramid_levels; ++level)
+    {
+        ndiffer = pixels_differing(&a->pyramid[level], &b->pyramid[level]);
+        check(ndiffer == 0, "%s: %d pixels differ at pyramid level %d", what, ndiffer, level+1);
+    }
+}
+
+/* Positions around the end of the path, where the test scans are taken */
+static int
+test_positions(
+    position_t * positions)
+{
+    int npositions = 0;
+
+    int dx = 0;
+    for (dx=-200; dx<=200; dx+=100)
+    {
+        int dy = 0;
+        for (dy=-200; dy<=200; dy+=100)
+        {
+            int dtheta = 0;
+            for (dtheta=-4; dtheta<=4; dtheta+=2)
+            {
+                position_t position = path_position(MAP_SCANS);
+                position.x_mm += dx + 0.37;
+                position.y_mm += dy - 0.21;
+                position.theta_degrees += dtheta + 0.13;
+                positions[npositions++] = position;
+            }
+        }
+    }
+
+    /* near the corners of the map, where some points fall outside it */
+    positions[npositions].x_mm = 1000;
+    positions[npositions].y_mm = 1500;
+    positions[npositions++].theta_degrees = 30;
+
+    positions[npositions].x_mm = MAP_SIZE_METERS * 1000 - 1200;
+    positions[npositions].y_mm = MAP_SIZE_METERS * 1000 - 800;
+    positions[npositions++].theta_degrees = -100;
+
+    return npositions;
+}
+
+#define MAX_TEST_POSITIONS 200
+
+/* Tests -------------------------------------------------------------------- */
+
+static void
+test_map_update_rings(void)
+{
+    static const int NPARTS[] = {1, 2, 3, 7};
+
+    int sparse = 0;
+    for (sparse=0; sparse<2; ++sparse)
+    {
+        int s = 0;
+        for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+        {
+            int p = 0;
+            for (p=0; p<NELEMS(NPARTS); ++p)
+            {
+                map_t serial, rings;
+                make_map(&serial, sparse, MAP_SIZE_PIXELS, SCAN_SIZES[s], SCAN_ANGLES[s]);
+                make_map(&rings, sparse, MAP_SIZE_PIXELS, SCAN_SIZES[s], SCAN_ANGLES[s]);
+                map_init_pyramid(&serial, PYRAMID_LEVELS);
+                map_init_pyramid(&rings, PYRAMID_LEVELS);
+
+                scan_t scan;
+                make_scan(&scan, 3, SCAN_SIZES[s], SCAN_ANGLES[s], MAP_SCANS);
+                position_t position = path_position(MAP_SCANS);
+
+                map_update(&serial, &scan, position, DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM);
+
+                /* Update the parts last to first, as threads may */
+                int bounds[8];
+                map_update_ring_bounds(&rings, &scan, position, DEFAULT_HOLE_WIDTH_MM, NPARTS[p], bounds);
+
+                int k = 0;
+                for (k=NPARTS[p]-1; k>=0; --k)
+                {
+                    map_update_rings(&rings, &scan, position, DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM,
+                                     bounds[k], bounds[k+1]);
+                }
+
+                map_update_finish(&rings, &scan, position, DEFAULT_HOLE_WIDTH_MM);
+
+                char what[100];
+                sprintf(what, "map_update_rings, %s map, scan size %d, %d parts",
+                        sparse ? "sparse" : "dense", SCAN_SIZES[s], NPARTS[p]);
+                check_same_maps(&serial, &rings, what);
+
+                scan_free(&scan);
+                map_free(&serial);
+                map_free(&rings);
+            }
+        }
+    }
+}
+
+static void
+test_sparse_map(void)
+{
+    position_t positions[MAX_TEST_POSITIONS];
+    int npositions = test_positions(positions);
+
+    /* Sparse maps are always scored by the sisd kernel */
+    const char * default_kernel = distance_scan_to_map_kernel();
+    distance_scan_to_map_select("sisd");
+
+    int s = 0;
+    for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+    {
+        map_t dense, sparse;
+        make_map(&dense, 0, MAP_SIZE_PIXELS, SCAN_SIZES[s], SCAN_ANGLES[s]);
+        make_map(&sparse, 1, MAP_SIZE_PIXELS, SCAN_SIZES[s], SCAN_ANGLES[s]);
+        map_init_pyramid(&dense, PYRAMID_LEVELS);
+        map_init_pyramid(&sparse, PYRAMID_LEVELS);
+
+        /* One more scan, to update the pyramids as well as build them */
+        scan_t scan;
+        make_scan(&scan, 1, SCAN_SIZES[s], SCAN_ANGLES[s], MAP_SCANS);
+        map_update(&dense, &scan, path_position(MAP_SCANS), DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM);
+        map_update(&sparse, &scan, path_position(MAP_SCANS), DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM);
+
+        char what[100];
+        sprintf(what, "sparse map, scan size %d", SCAN_SIZES[s]);
+        check_same_maps(&dense, &sparse, what);
+
+        int ntiles = sparse.size_tiles * sparse.size_tiles;
+        check(sparse.ntiles_allocated < ntiles, "%s: all %d tiles allocated", what, ntiles);
+
+        int npix = MAP_SIZE_PIXELS * MAP_SIZE_PIXELS;
+        char * dense_bytes = (char *)malloc(npix);
+        char * sparse_bytes = (char *)malloc(npix);
+        map_get(&dense, dense_bytes);
+        map_get(&sparse, sparse_bytes);
+        check(!memcmp(dense_bytes, sparse_bytes, npix), "%s: map_get differs", what);
+        free(dense_bytes);
+        free(sparse_bytes);
+
+        int k = 0;
+        for (k=0; k<npositions; ++k)
+        {
+            int level = 0;
+            for (level=0; level<=PYRAMID_LEVELS; ++level)
+            {
+                int d_dense = distance_scan_to_map_level(&dense, &scan, positions[k], level);
+                int d_sparse = distance_scan_to_map_level(&sparse, &scan, positions[k], level);
+                check(d_dense == d_sparse, "%s, position %d, level %d: distances %d, %d",
+                      what, k, level, d_dense, d_sparse);
+            }
+        }
+
+        scan_free(&scan);
+        map_free(&dense);
+        map_free(&sparse);
+    }
+
+    distance_scan_to_map_select(default_kernel);
+}
+
+static void
+test_map_get_tiles(void)
+{
+    map_t map;
+    make_map(&map, 0, MAP_SIZE_PIXELS, SCAN_SIZES[1], SCAN_ANGLES[1]);
+
+    int npix = MAP_SIZE_PIXELS * MAP_SIZE_PIXELS;
+    char * before = (char *)malloc(npix);
+    char * after = (char *)malloc(npix);
+    map_get(&map, before);
+
+    unsigned version = map.version;
+
+    scan_t scan;
+    make_scan(&scan, 3, SCAN_SIZES[1], SCAN_ANGLES[1], MAP_SCANS);
+    map_update(&map, &scan, path_position(MAP_SCANS), DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM);
+    map_get(&map, after);
+
+    int ntiles = map.size_tiles * map.size_tiles;
+    int * tiles = int_alloc(ntiles);
+    char * tile_bytes = (char *)malloc(ntiles * MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS);
+    char * changed = (char *)calloc(ntiles, 1);
+
+    int nchanged = map_get_tiles(&map, version, tiles, tile_bytes);
+
+    check(nchanged > 0 && nchanged < ntiles, "map_get_tiles: %d of %d tiles changed", nchanged, ntiles);
+
+    int k = 0;
+    for (k=0; k<nchanged; ++k)
+    {
+        changed[tiles[k]] = 1;
+
+        int x0 = (tiles[k] % map.size_tiles) * MAP_TILE_SIZE_PIXELS;
+        int y0 = (tiles[k] / map.size_tiles) * MAP_TILE_SIZE_PIXELS;
+
+        int ndiffer = 0;
+
+        int y = 0;
+        for (y=0; y<MAP_TILE_SIZE_PIXELS; ++y)
+        {
+            int x = 0;
+            for (x=0; x<MAP_TILE_SIZE_PIXELS; ++x)
+            {
+                char expected = (x0 + x < MAP_SIZE_PIXELS && y0 + y < MAP_SIZE_PIXELS) ?
+                                after[(y0 + y) * MAP_SIZE_PIXELS + x0 + x] : 0;
+
+                ndiffer += tile_bytes[(k * MAP_TILE_SIZE_PIXELS + y) * MAP_TILE_SIZE_PIXELS + x] != expected;
+            }
+        }
+
+        check(ndiffer == 0, "map_get_tiles: %d pixels of tile %d differ from map_get", ndiffer, tiles[k]);
+    }
+
+    /* Every pixel that changed is in a tile returned */
+    int nmissed = 0;
+    for (k=0; k<npix; ++k)
+    {
+        int x = k % MAP_SIZE_PIXELS;
+        int y = k / MAP_SIZE_PIXELS;
+
+        nmissed += before[k] != after[k] &&
+                   !changed[(y / MAP_TILE_SIZE_PIXELS) * map.size_tiles + x / MAP_TILE_SIZE_PIXELS];
+    }
+
+    check(nmissed == 0, "map_get_tiles: %d changed pixels outside the tiles returned", nmissed);
+
+    free(tiles);
+    free(tile_bytes);
+    free(changed);
+    free(before);
+    free(after);
+    scan_free(&scan);
+    map_free(&map);
+}
+
+/* Sorts points by x, then y */
+static int
+point_compar(
+    const void * a,
+    const void * b)
+{
+    const float * p = (const float *)a;
+    const float * q = (const float *)b;
+
+    return p[0] != q[0] ? (p[0] < q[0] ? -1 : 1) : (p[1] != q[1] ? (p[1] < q[1] ? -1 : 1) : 0);
+}
+
+/* The obstacle points kept for the SIMD kernels are the scan's obstacles, in another order */
+static void
+check_obstacles(
+    scan_t * scan,
+    const char * what)
+{
+    float * expected = float_alloc(2 * scan->npoints + 2);
+    float * stratified = float_alloc(2 * scan->obst_npoints + 2);
+
+    int nexpected = 0;
+    double reach_mm = 0;
+
+    int i = 0;
+    for (i=0; i<scan->npoints; ++i)
+    {
+        if (scan->value[i] == OBSTACLE)
+        {
+            expected[2*nexpected] = (float)scan->x_mm[i];
+            expected[2*nexpected+1] = (float)scan->y_mm[i];
+            nexpected++;
+
+            double r = sqrt(scan->x_mm[i] * scan->x_mm[i] + scan->y_mm[i] * scan->y_mm[i]);
+            reach_mm = r > reach_mm ? r : reach_mm;
+        }
+    }
+
+    for (i=0; i<scan->obst_npoints; ++i)
+    {
+        stratified[2*i] = scan->obst_x_mm[i];
+        stratified[2*i+1] = scan->obst_y_mm[i];
+    }
+
+    check(nexpected == scan->obst_npoints, "%s: %d obstacle points kept of %d", what, scan->obst_npoints, nexpected);
+
+    if (nexpected == scan->obst_npoints)
+    {
+        qsort(expected, nexpected, 2 * sizeof(float), point_compar);
+        qsort(stratified, nexpected, 2 * sizeof(float), point_compar);
+        check(!memcmp(expected, stratified, 2 * nexpected * sizeof(float)), "%s: obstacle points differ", what);
+    }
+
+    check(scan->obst_reach_mm == reach_mm, "%s: obstacle reach %f, expected %f", what, scan->obst_reach_mm, reach_mm);
+
+    free(expected);
+    free(stratified);
+}
+
+static void
+test_scoring(void)
+{
+    position_t positions[MAX_TEST_POSITIONS];
+    int npositions = test_positions(positions);
+
+    int distances[MAX_TEST_POSITIONS];
+    int sisd_distances[MAX_TEST_POSITIONS];
+
+    const char * default_kernel = distance_scan_to_map_kernel();
+
+    int s = 0;
+    for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+    {
+        map_t map;
+        make_map(&map, 0, MAP_SIZE_PIXELS, SCAN_SIZES[s], SCAN_ANGLES[s]);
+        map_init_pyramid(&map, PYRAMID_LEVELS);
+
+        int span = 0;
+        for (span=1; span<=3; span+=2)
+        {
+            scan_t scan;
+            make_scan(&scan, span, SCAN_SIZES[s], SCAN_ANGLES[s], MAP_SCANS);
+
+            char what[100];
+            sprintf(what, "scan size %d, span %d", SCAN_SIZES[s], span);
+            check_obstacles(&scan, what);
+
+            int k = 0;
+            for (k=0; k<NELEMS(KERNELS); ++k)
+            {
+                if (distance_scan_to_map_select(KERNELS[k]))
+                {
+                    continue;
+                }
+
+                sprintf(what, "%s kernel, scan size %d, span %d", KERNELS[k], SCAN_SIZES[s], span);
+
+                distance_scan_to_map_batch(&map, &scan, positions, npositions, distances);
+
+                int p = 0;
+                for (p=0; p<npositions; ++p)
+                {
+                    int d = distance_scan_to_map(&map, &scan, positions[p]);
+
+                    if (k == 0)
+                    {
+                        sisd_distances[p] = d;
+                    }
+
+                    check(distances[p] == d, "%s, position %d: batch %d, single %d", what, p, distances[p], d);
+
+                    int bounded = distance_scan_to_map_bounded(&map, &scan, positions[p], INT_MAX);
+                    check(bounded == d, "%s, position %d: unbounded %d, single %d", what, p, bounded, d);
+
+                    /* Below the bound, the exact distance; otherwise at least the bound */
+                    bounded = distance_scan_to_map_bounded(&map, &scan, positions[p], d + 1);
+                    check(bounded == d, "%s, position %d: bound %d gave %d, single %d", what, p, d+1, bounded, d);
+
+                    int bound = d / 2;
+                    bounded = distance_scan_to_map_bounded(&map, &scan, positions[p], bound);
+                    check(bounded >= bound, "%s, position %d: bound %d gave %d", what, p, bound, bounded);
+
+                    int level0 = distance_scan_to_map_level(&map, &scan, positions[p], 0);
+                    check(level0 == d, "%s, position %d: level 0 %d, single %d", what, p, level0, d);
+
+                    int sisd = sisd_distances[p];
+                    check((d == -1) == (sisd == -1) && fabs(d - sisd) <= KERNEL_TOLERANCE * sisd,
+                          "%s, position %d: %d, sisd %d", what, p, d, sisd);
+                }
+            }
+
+            distance_scan_to_map_select(default_kernel);
+
+            scan_free(&scan);
+        }
+
+        map_free(&map);
+    }
+}
+
+static void
+test_scan_update_multiple(void)
+{
+    int s = 0;
+    for (s=0; s<NELEMS(SCAN_SIZES); ++s)
+    {
+        int * distances_mm = int_alloc(SCAN_SIZES[s]);
+        float * angles_deg = float_alloc(SCAN_SIZES[s]);
+        simulate_scan(distances_mm, angles_deg, SCAN_SIZES[s], SCAN_ANGLES[s], 300, -200, 10, 7);
+
+        int interpolate = 0;
+        for (interpolate=0; interpolate<2; ++interpolate)
+        {
+            scan_t single[2], multiple[2];
+            scan_t * scans[2] = {&multiple[0], &multiple[1]};
+
+            int k = 0;
+            for (k=0; k<2; ++k)
+            {
+                int span = 1 + 2 * k;
+                scan_init(&single[k], span, SCAN_SIZES[s], SCAN_RATE_HZ, SCAN_ANGLES[s], NO_DETECTION_MM, 0, 0);
+                scan_init(&multiple[k], span, SCAN_SIZES[s], SCAN_RATE_HZ, SCAN_ANGLES[s], NO_DETECTION_MM, 0, 0);
+
+                /* with velocities, to correct for the motion of the robot during the scan */
+                scan_update(&single[k], interpolate ? angles_deg : NULL, distances_mm, SCAN_SIZES[s],
+                            DEFAULT_HOLE_WIDTH_MM, 120, 15);
+            }
+
+            scan_update_multiple(scans, 2, interpolate ? angles_deg : NULL, distances_mm, SCAN_SIZES[s],
+                                 DEFAULT_HOLE_WIDTH_MM, 120, 15);
+
+            for (k=0; k<2; ++k)
+            {
+                char what[100];
+                sprintf(what, "scan_update_multiple, scan size %d, span %d%s", SCAN_SIZES[s], 1 + 2 * k,
+                        interpolate ? ", interpolated" : "");
+
+                scan_t * a = &single[k];
+                scan_t * b = &multiple[k];
+
+                int same = a->npoints == b->npoints && a->obst_npoints == b->obst_npoints &&
+                           !memcmp(a->x_mm, b->x_mm, a->npoints * sizeof(double)) &&
+                           !memcmp(a->y_mm, b->y_mm, a->npoints * sizeof(double)) &&
+                           !memcmp(a->value, b->value, a->npoints * sizeof(int)) &&
+                           !memcmp(a->obst_x_mm, b->obst_x_mm, a->obst_npoints * sizeof(float)) &&
+                           !memcmp(a->obst_y_mm, b->obst_y_mm, a->obst_npoints * sizeof(float)) &&
+                           a->obst_reach_mm == b->obst_reach_mm;
+
+                check(same, "%s: scans differ", what);
+
+                check_obstacles(b, what);
+
+                scan_free(&single[k]);
+                scan_free(&multiple[k]);
+            }
+        }
+
+        free(distances_mm);
+        free(angles_deg);
+    }
+}
+
+/* Overwrites bytes of a file at an offset */
+static void
+patch_file(
+    const char * filename,
+    long offset,
+    const void * bytes,
+    int nbytes)
+{
+    FILE * file = fopen(filename, "r+b");
+
+    if (file)
+    {
+        fseek(file, offset, SEEK_SET);
+        fwrite(bytes, 1, nbytes, file);
+        fclose(file);
+    }
+}
+
+static void
+test_map_file(void)
+{
+    static const int MODES[] = {MAP_OPEN_COPY, MAP_OPEN_READ_ONLY, MAP_OPEN_COPY_ON_WRITE};
+    static const char * MODE_NAMES[] = {"copy", "read-only", "copy-on-write"};
+
+    int sparse = 0;
+    for (sparse=0; sparse<2; ++sparse)
+    {
+        map_t map;
+        make_map(&map, sparse, MAP_SIZE_PIXELS, SCAN_SIZES[1], SCAN_ANGLES[1]);
+        map.origin_x_mm = -1234.5;
+        map.origin_y_mm = 678.25;
+
+        check(map_save(&map, MAP_FILE) == 0, "map_save: %s map not saved", sparse ? "sparse" : "dense");
+
+        scan_t scan;
+        make_scan(&scan, 1, SCAN_SIZES[1], SCAN_ANGLES[1], MAP_SCANS);
+        position_t position = path_position(MAP_SCANS);
+
+        int m = 0;
+        for (m=0; m<NELEMS(MODES); ++m)
+        {
+            char what[100];
+            sprintf(what, "map_open, %s map, %s", sparse ? "sparse" : "dense", MODE_NAMES[m]);
+
+            map_t opened;
+            if (map_open(&opened, MAP_FILE, MODES[m]))
+            {
+                check(0, "%s: not opened", what);
+                continue;
+            }
+
+            check(opened.size_pixels == map.size_pixels && opened.size_meters == map.size_meters &&
+                  opened.origin_x_mm == map.origin_x_mm && opened.origin_y_mm == map.origin_y_mm,
+                  "%s: header differs", what);
+
+            int ndiffer = pixels_differing(&map, &opened);
+            check(ndiffer == 0, "%s: %d pixels differ", what, ndiffer);
+
+            /* A read-only map refuses updates, reporting them; the others take them */
+            unsigned version = opened.version;
+            map_update(&opened, &scan, position, DEFAULT_MAP_QUALITY, DEFAULT_HOLE_WIDTH_MM);
+            ndiffer = pixels_differing(&map, &opened);
+
+            if (MODES[m] == MAP_OPEN_READ_ONLY)
+            {
+                check(ndiffer == 0 && opened.version == version, "%s: updated", what);
+            }
+            else
+            {
+                check(ndiffer > 0, "%s: not updated", what);
+            }
+
+            map_free(&opened);
+        }
+
+        /* Updating a copy-on-write map leaves the file as saved */
+        map_t reopened;
+        if (map_open(&reopened, MAP_FILE, MAP_OPEN_COPY) == 0)
+        {
+            int ndiffer = pixels_differing(&map, &reopened);
+            check(ndiffer == 0, "map_open: %d pixels of the file changed", ndiffer);
+            map_free(&reopened);
+        }
+
+        scan_free(&scan);
+        map_free(&map);
+    }
+
+    map_t map;
+    check(map_open(&map, MAP_FILE, 99) == -1, "map_open: unknown mode accepted");
+    check(map_open(&map, "breezytest.missing", MAP_OPEN_COPY) == -1, "map_open: missing file accepted");
+
+    /* Header fields: format version at byte 8, byte order at 12, pixels offset at 16 */
+    unsigned char bad[4] = {0xFF, 0xFF, 0xFF, 0x7F};
+
+    long offset = 8;
+    for (offset=8; offset<=16; offset+=4)
+    {
+        map_t saved;
+        make_map(&saved, 0, 400, SCAN_SIZES[0], SCAN_ANGLES[0]);
+        map_save(&saved, MAP_FILE);
+        map_free(&saved);
+
+        patch_file(MAP_FILE, offset, bad, 4);
+        check(map_open(&map, MAP_FILE, MAP_OPEN_COPY) == -1, "map_open: bad header field at byte %ld accepted",
+              offset);
+    }
+
+    /* A file cut short of its pixels */
+    map_t saved;
+    make_map(&saved, 0, 400, SCAN_SIZES[0], SCAN_ANGLES[0]);
+    map_save(&saved, MAP_FILE);
+    map_free(&saved);
+
+    char page[4096 + 100];
+    size_t nread = 0;
+
+    FILE * file = fopen(MAP_FILE, "rb");
+    if (file)
+    {
+        nread = fread(page, 1, sizeof(page), file);
+        fclose(file);
+    }
+
+    file = fopen(MAP_FILE, "wb");
+    if (file)
+    {
+        fwrite(page, 1, nread, file);
+        fclose(file);
+    }
+
+    check(map_open(&map, MAP_FILE, MAP_OPEN_COPY) == -1, "map_open: truncated file accepted");
+
+    remove(MAP_FILE);
+}
+
+/* Searches from start with a fixed seed, scoring from pre-rotated bins */
+static position_t
+rotated_search(
+    map_t * map,
+    scan_t * scan,
+    position_t start,
+    double sigma_theta_degrees,
+    void * randomizer,
+    int seed)
+{
+    random_init(randomizer, seed);
+
+    if (map->pyramid_levels)
+    {
+        return rmhc_position_search_coarse_to_fine(start, map, scan, DEFAULT_SIGMA_XY_MM, sigma_theta_degrees,
+                                                   DEFAULT_MAX_SEARCH_ITER, randomizer, RMHC_SEARCH_ROTATED_BINS);
+    }
+
+    return rmhc_position_search_ex(start, map, scan, DEFAULT_SIGMA_XY_MM, sigma_theta_degrees,
+                                   DEFAULT_MAX_SEARCH_ITER, randomizer, RMHC_SEARCH_ROTATED_BINS);
+}
+
+static void
+test_rotated_search(void)
+{
+    void * randomizer = random_new(9999);
+
+    position_t start = path_position(MAP_SCANS);
+    start.x_mm += 50;
+    start.theta_degrees += 1;
+
+    int levels = 0;
+    for (levels=0; levels<=PYRAMID_LEVELS; levels+=PYRAMID_LEVELS)
+    {
+        map_t map;
+        make_map(&map, 0, MAP_SIZE_PIXELS, SCAN_SIZES[1], SCAN_ANGLES[1]);
+        map_init_pyramid(&map, levels);
+
+        char what[100];
+        sprintf(what, "rotated bins, %d pyramid levels", levels);
+
+        /* The exact option is the seven-argument search */
+        if (!levels)
+        {
+            scan_t scan;
+            make_scan(&scan, 1, SCAN_SIZES[1], SCAN_ANGLES[1], MAP_SCANS);
+
+            random_init(randomizer, 9999);
+            position_t exact = rmhc_position_search(start, &map, &scan, DEFAULT_SIGMA_XY_MM,
+                                                    DEFAULT_SIGMA_THETA_DEGREES, DEFAULT_MAX_SEARCH_ITER, randomizer);
+            random_init(randomizer, 9999);
+            position_t exact_ex = rmhc_position_search_ex(start, &map, &scan, DEFAULT_SIGMA_XY_MM,
+                                                          DEFAULT_SIGMA_THETA_DEGREES, DEFAULT_MAX_SEARCH_ITER,
+                                                          randomizer, RMHC_SEARCH_EXACT);
+            check(!memcmp(&exact, &exact_ex, sizeof(position_t)), "rmhc_position_search_ex: exact search differs");
+
+            scan_free(&scan);
+        }
+
+        /* The same search on a scan with no rotated points yet, then again on it */
+        scan_t cold;
+        make_scan(&cold, 1, SCAN_SIZES[1], SCAN_ANGLES[1], MAP_SCANS);
+        position_t first = rotated_search(&map, &cold, start, DEFAULT_SIGMA_THETA_DEGREES, randomizer, 9999);
+        position_t again = rotated_search(&map, &cold, start, DEFAULT_SIGMA_THETA_DEGREES, randomizer, 9999);
+        check(!memcmp(&first, &again, sizeof(position_t)), "%s: search differs when repeated", what);
+
+        /* ... and on a scan whose cache already holds the points of searches kept near other angles,
+           some of which share slots with the bins of the search from start */
+        scan_t warm;
+        make_scan(&warm, 1, SCAN_SIZES[1], SCAN_ANGLES[1], MAP_SCANS);
+
+        int offset = 0;
+        for (offset=-60; offset<=60; ++offset)
+        {
+            position_t other = start;
+            other.theta_degrees += offset;
+            rotated_search(&map, &warm, other, 0.5, randomizer, offset + 100);
+        }
+
+        position_t after = rotated_search(&map, &warm, start, DEFAULT_SIGMA_THETA_DEGREES, randomizer, 9999);
+        check(!memcmp(&first, &after, sizeof(position_t)), "%s: search depends on earlier searches", what);
+
+        scan_free(&cold);
+        scan_free(&warm);
+        map_free(&map);
+    }
+
+    random_free(randomizer);
+}
+
+int
+main(
+    int argc,
+    char ** argv)
+{
+    test_map_update_rings();
+    test_sparse_map();
+    test_map_get_tiles();
+    test_scoring();
+    test_scan_update_multiple();
+    test_map_file();
+    test_rotated_search();
+
+    printf("breezytest: %d checks, %d failed (default kernel %s)\n", nchecks, nfailures,
+           distance_scan_to_map_kernel());
+
+    return nfailures ? 1 : 0;
+}
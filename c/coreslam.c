@@ -35,12 +35,24 @@
 #include <time.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
 #include "coreslam.h"
 #include "coreslam_internals.h"
 
 #include "random.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 /* For angle/distance interpolation ------------------------------- */
 
 typedef struct angle_distance_pair {
@@ -54,40 +66,133 @@ typedef struct interpolation {
 
     /* for sorting */
     angle_distance_pair_t * angle_distance_pairs;
+    angle_distance_pair_t * merge_buffer;
 
     /* for interpolating after sorting */
     float * angles;
     float * distances;
 
+    /* distances resampled to one per degree */
+    int * resampled_mm;
 
 } interpolation_t;
 
-static int angle_compar(const void * v1, const void * v2)
-{
-    angle_distance_pair_t * pair1 = (angle_distance_pair_t *)v1;
-    angle_distance_pair_t * pair2 = (angle_distance_pair_t *)v2;
+/* Runs shorter than this are extended by insertion sort before merging */
+#define MIN_SORTED_RUN 32
 
-    return pair1->angle < pair2->angle ? -1 : 1;
+/* Returns the end of the non-descending run starting at start */
+static int ascending_run_end(angle_distance_pair_t * pairs, int start, int n)
+{
+    int end = start + 1;
+    
+    while (end < n && pairs[end].angle >= pairs[end-1].angle)
+    {
+        end++;
+    }
+    
+    return end;
 }
 
-// http://www.cplusplus.com/forum/general/216928/
-float interpolate(float xData[], float yData[], int size, float x)
+/* Stable merge of sorted src[start,middle) and src[middle,end) into dst */
+static void merge_runs(angle_distance_pair_t * src, angle_distance_pair_t * dst, int start, int middle, int end)
 {
-    int i = 0;                                                                  // find left end of interval for interpolation
-    if ( x >= xData[size - 2] ) {                                               // special case: beyond right end 
-        i = size - 2;
+    int i = start;
+    int j = middle;
+    int k = start;
+    
+    while (i < middle && j < end)
+    {
+        dst[k++] = (src[j].angle < src[i].angle) ? src[j++] : src[i++];
+    }
+    
+    while (i < middle)
+    {
+        dst[k++] = src[i++];
     }
-    else {
-        while ( x > xData[i+1] ) i++;
+    
+    while (j < end)
+    {
+        dst[k++] = src[j++];
     }
-    float xL = xData[i], yL = yData[i], xR = xData[i+1], yR = yData[i+1];      // points on either side (unless beyond ends)
-
-    float dydx = ( yR - yL ) / ( xR - xL );                                    // gradient
+}
 
-    return yL + dydx * ( x - xL );                                              // linear interpolation
+/* Sorts pairs by angle with a natural merge sort, so already-sorted input costs one pass 
+   and input from a rotating lidar (sorted except for a wrap-around, or with a little local 
+   jitter) costs only a few.  Returns whichever of pairs or buffer holds the result. */
+static angle_distance_pair_t * sort_angle_distance_pairs(angle_distance_pair_t * pairs, 
+                                                         angle_distance_pair_t * buffer, 
+                                                         int n)
+{
+    int start = 0;
+    
+    /* Make every run at least MIN_SORTED_RUN long, reversing descending runs */
+    while (start < n)
+    {
+        int end = ascending_run_end(pairs, start, n);
+        
+        if (end - start == 1)
+        {
+            while (end < n && pairs[end].angle < pairs[end-1].angle)
+            {
+                end++;
+            }
+            
+            int i = start;
+            int j = end - 1;
+            for (; i<j; ++i, --j)
+            {
+                angle_distance_pair_t tmp = pairs[i];
+                pairs[i] = pairs[j];
+                pairs[j] = tmp;
+            }
+        }
+        
+        int limit = start + MIN_SORTED_RUN < n ? start + MIN_SORTED_RUN : n;
+        
+        for (; end<limit; ++end)
+        {
+            angle_distance_pair_t pair = pairs[end];
+            
+            int j = end;
+            for (; j>start && pair.angle < pairs[j-1].angle; --j)
+            {
+                pairs[j] = pairs[j-1];
+            }
+            pairs[j] = pair;
+        }
+        
+        start = end;
+    }
+    
+    /* Merge neighboring runs until there is only one */
+    angle_distance_pair_t * src = pairs;
+    angle_distance_pair_t * dst = buffer;
+    
+    while (ascending_run_end(src, 0, n) < n)
+    {
+        for (start=0; start<n; )
+        {
+            int middle = ascending_run_end(src, start, n);
+            int end = middle < n ? ascending_run_end(src, middle, n) : n;
+            
+            merge_runs(src, dst, start, middle, end);
+            
+            start = end;
+        }
+        
+        angle_distance_pair_t * tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    
+    return src;
 }
 
-static void interpolate_scan(scan_t * scan, float * lidar_angles_deg, int * lidar_distances_mm, int scan_size)
+/* Resamples distances to one per degree, returning the resampled distances.  Each degree is
+   linearly interpolated (or extrapolated, at the ends) from the pair of measured angles 
+   around it; since degrees are visited in order, one walk over the sorted angles finds all 
+   the pairs. */
+static int * interpolate_scan(scan_t * scan, float * lidar_angles_deg, int * lidar_distances_mm, int scan_size)
 {
     // Sort angles, preserving distance for each angle
 
@@ -103,23 +208,47 @@ static void interpolate_scan(scan_t * scan, float * lidar_angles_deg, int * lida
         pair->distance = lidar_distances_mm[k];
     }
 
-    qsort(pairs, scan_size, sizeof(angle_distance_pair_t), angle_compar);
+    pairs = sort_angle_distance_pairs(pairs, interp->merge_buffer, scan_size);
 
     /* Copy sorted angle/distance pairs to arrays for interpolation */
 
+    float * angles = interp->angles;
+    float * distances = interp->distances;
+
     for (k=0; k<scan_size; ++k) 
     {
         angle_distance_pair_t pair = pairs[k];
-        interp->angles[k] = pair.angle;
-        interp->distances[k] = pair.distance;
+        angles[k] = pair.angle;
+        distances[k] = pair.distance;
     }
 
     /* Interpolate */
 
+    int i = 0;  /* left end of interval for interpolation */
+
     for (k=0; k<scan->size; ++k) 
     {
-        lidar_distances_mm[k] = (int)interpolate(interp->angles, interp->distances, scan_size, (float)k);
+        float x = (float)k;
+
+        /* Beyond right end, extrapolate from last interval */
+        if (x >= angles[scan_size-2])
+        {
+            i = scan_size - 2;
+        }
+        else
+        {
+            while (x > angles[i+1])
+            {
+                i++;
+            }
+        }
+
+        float dydx = (distances[i+1] - distances[i]) / (angles[i+1] - angles[i]);
+
+        interp->resampled_mm[k] = (int)(distances[i] + dydx * (x - angles[i]));
     }
+
+    return interp->resampled_mm;
 }
 
 /* Local helpers--------------------------------------------------- */
@@ -193,10 +322,154 @@ static int
 }
 
 
+/* Advances the value profile of a ray, which ramps down to the obstacle value and back 
+   up over the last 2*derrorv steps */
+static inline void
+        ray_profile_step(
+        int x,
+        int dx,
+        int derrorv,
+        int incv,
+        int incerrorv,
+        int sincv,
+        int * pixval,
+        int * errorv)
+{
+    if (x <= dx - derrorv)
+    {
+        *pixval += incv;
+        *errorv += incerrorv;
+        if (*errorv > derrorv)
+        {
+            *pixval += sincv;
+            *errorv -= derrorv;
+        }
+    }
+    else
+    {
+        *pixval -= incv;
+        *errorv -= incerrorv;
+        if (*errorv < 0)
+        {
+            *pixval -= sincv;
+            *errorv += derrorv;
+        }
+    }
+}
+
+/* What to do to the tiles under a ray, besides changing its pixels */
+#define MARK_TILES      1
+#define ALLOCATE_TILES  2
+
+/* Gives tile t of a sparse map its own pixels if it has none yet */
+static void
+        map_tile_allocate(
+        map_t * map,
+        int t)
+{
+    if (map->tiles[t] == map->unknown_tile)
+    {
+        map->tiles[t] = (pixel_t *)safe_malloc(MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS * sizeof(pixel_t));
+        memcpy(map->tiles[t], map->unknown_tile, MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS * sizeof(pixel_t));
+        map->ntiles_allocated++;
+    }
+}
+
+/* Returns the address of the pixel at (x, y) of a sparse map, allocating its tile if needed */
+static pixel_t *
+        map_tile_pixel(
+        map_t * map,
+        int x,
+        int y)
+{
+    int t = (y / MAP_TILE_SIZE_PIXELS) * map->size_tiles + x / MAP_TILE_SIZE_PIXELS;
+    
+    map_tile_allocate(map, t);
+    
+    return map->tiles[t] + (y % MAP_TILE_SIZE_PIXELS) * MAP_TILE_SIZE_PIXELS + x % MAP_TILE_SIZE_PIXELS;
+}
+
+/* Sets the pixel at (x, y), leaving tiles of a sparse map unallocated if it does not change */
+static void
+        map_set_pixel(
+        map_t * map,
+        int x,
+        int y,
+        pixel_t value)
+{
+    if (!map->tiles)
+    {
+        map->pixels[y * map->size_pixels + x] = value;
+    }
+    
+    else if (map_pixel(map, x, y) != value)
+    {
+        *map_tile_pixel(map, x, y) = value;
+    }
+}
+
+/* Marks the tiles holding the pixels of a ray with the current map version, and/or allocates 
+   them in a sparse map, as flags say.  The ray takes dxc steps along its major axis from 
+   (x1, y1), in direction inca, and has taken ceil((2*dyc*x - dxc) / (2*dxc)) steps along its 
+   minor axis, in direction incb, at step x.  If swapped, the major axis is y. */
+static void
+        mark_ray_tiles(
+        map_t * map,
+        int x1,
+        int y1,
+        int dxc,
+        int dyc,
+        int inca,
+        int incb,
+        int swapped,
+        int flags)
+{
+    int a1 = swapped ? y1 : x1;
+    int b1 = swapped ? x1 : y1;
+    
+    int x = 0;
+    while (x <= dxc)
+    {
+        int a = a1 + inca * x;
+        
+        /* last step in the same column of tiles */
+        int xe = x + (inca > 0 ? MAP_TILE_SIZE_PIXELS - 1 - a % MAP_TILE_SIZE_PIXELS : a % MAP_TILE_SIZE_PIXELS);
+        xe = xe < dxc ? xe : dxc;
+        
+        int bstart = b1 + incb * (dxc ? (int)(((int64_t)2 * dyc * x + dxc - 1) / (2 * dxc)) : 0);
+        int bend   = b1 + incb * (dxc ? (int)(((int64_t)2 * dyc * xe + dxc - 1) / (2 * dxc)) : 0);
+        
+        int ta = a / MAP_TILE_SIZE_PIXELS;
+        int tb = 0;
+        for (tb = bstart / MAP_TILE_SIZE_PIXELS; ; tb += incb)
+        {
+            int tx = swapped ? tb : ta;
+            int ty = swapped ? ta : tb;
+            int t = ty * map->size_tiles + tx;
+            
+            if (flags & MARK_TILES)
+            {
+                map->tile_versions[t] = map->version;
+            }
+            
+            if ((flags & ALLOCATE_TILES) && map->tiles)
+            {
+                map_tile_allocate(map, t);
+            }
+            
+            if (tb == bend / MAP_TILE_SIZE_PIXELS)
+            {
+                break;
+            }
+        }
+        
+        x = xe + 1;
+    }
+}
+
 static void
         map_laser_ray(
-        pixel_t * map_pixels,
-        int map_size,
+        map_t * map,
         int x1,
         int y1,
         int x2,
@@ -204,8 +477,13 @@ static void
         int xp,
         int yp,
         int value,
-        int alpha)
+        int alpha,
+        int ring_start,
+        int ring_end,
+        int tile_flags)
 {
+    pixel_t * map_pixels = map->pixels;
+    int map_size = map->size_pixels;
     
     int x2c = x2;
     int y2c = y2;
@@ -226,6 +504,11 @@ static void
         int sincv = (value > NO_OBSTACLE) ? 1 : -1;
         
         int derrorv = 0;
+        int swapped = 0;
+        
+        /* directions along the major and minor axes, for sparse maps */
+        int inca = (x2 > x1) ? 1 : -1;
+        int incb = (y2 > y1) ? 1 : -1;
         
         if (dx > dy)
         {
@@ -236,7 +519,9 @@ static void
             swap(&dx, &dy);
             swap(&dxc, &dyc);
             swap(&incptrx, &incptry);
+            swap(&inca, &incb);
             derrorv = abs(yp - y2);
+            swapped = 1;
         }
         
         if (!derrorv)
@@ -247,6 +532,11 @@ static void
         
         else
         {
+            if (tile_flags)
+            {
+                mark_ray_tiles(map, x1, y1, dxc, dyc, inca, incb, swapped, tile_flags);
+            }
+            
             int error = 2 * dyc - dxc;
             int horiz = 2 * dyc;
             int diago = 2 * (dyc - dxc);
@@ -256,53 +546,161 @@ static void
             
             int incerrorv = value - NO_OBSTACLE - derrorv * incv;
             
-            pixel_t * ptr = map_pixels + y1 * map_size + x1;
+            /* offset of the pixel in a dense map; a sparse map is addressed by coordinates */
+            int offset = y1 * map_size + x1;
+            int a1 = swapped ? y1 : x1;
+            int b1 = swapped ? x1 : y1;
+            int minor = 0;
+            
             int pixval = NO_OBSTACLE;
             
+            /* Step x is on ring x, so only steps in [ring_start, ring_end) are ours */
+            int xstart = ring_start > 0 ? ring_start : 0;
+            int xend = ring_end - 1 < dxc ? ring_end - 1 : dxc;
+            
             int x = 0;
-            for (x = 0; x <= dxc; x++, ptr += incptrx)
+            
+            /* Jump to the first step: the line has taken ceil((2*dyc*x - dxc) / (2*dxc)) minor 
+               steps by then, which keeps the error term in (2*dyc - 2*dxc, 2*dyc] */
+            if (xstart > 0 && xstart <= xend)
             {
-                if (x > dx - 2 * derrorv)
+                minor = (int)(((int64_t)2 * dyc * xstart + dxc - 1) / (2 * dxc));
+                
+                offset += xstart * incptrx + minor * incptry;
+                error = 2 * dyc * (xstart + 1) - dxc - 2 * dxc * minor;
+                
+                /* Value profile only changes near the obstacle */
+                for (x = dx - 2 * derrorv + 1 > 0 ? dx - 2 * derrorv + 1 : 0; x < xstart; x++)
+                {
+                    ray_profile_step(x, dx, derrorv, incv, incerrorv, sincv, &pixval, &errorv);
+                }
+            }
+            
+            if (map_pixels)
+            {
+                pixel_t * ptr = map_pixels + offset;
+                
+                for (x = xstart; x <= xend; x++, ptr += incptrx)
+                {
+                    if (x > dx - 2 * derrorv)
+                    {
+                        ray_profile_step(x, dx, derrorv, incv, incerrorv, sincv, &pixval, &errorv);
+                    }
+                    
+                    /* Integration into the map */
+                    *ptr = ((256 - alpha) * (*ptr) + alpha * (pixval >> PIXEL_SHIFT) + PIXEL_ROUNDING) >> 8;
+                    
+                    if (error > 0)
+                    {
+                        ptr += incptry;
+                        error += diago;
+                    } else
+                    {
+                        error += horiz;
+                    }
+                }
+            }
+            
+            /* Same steps through the tile directory of a sparse map, whose tiles were allocated 
+               when marked */
+            else
+            {
+                for (x = xstart; x <= xend; x++)
                 {
-                    if (x <= dx - derrorv)
+                    if (x > dx - 2 * derrorv)
                     {
-                        pixval += incv;
-                        errorv += incerrorv;
-                        if (errorv > derrorv)
-                        {
-                            pixval += sincv;
-                            errorv -= derrorv;
-                        }
+                        ray_profile_step(x, dx, derrorv, incv, incerrorv, sincv, &pixval, &errorv);
                     }
-                    else
+                    
+                    unsigned a = a1 + inca * x;
+                    unsigned b = b1 + incb * minor;
+                    
+                    pixel_t * ptr = swapped ? 
+                        map->tiles[(a / MAP_TILE_SIZE_PIXELS) * map->size_tiles + b / MAP_TILE_SIZE_PIXELS] + 
+                            (a % MAP_TILE_SIZE_PIXELS) * MAP_TILE_SIZE_PIXELS + b % MAP_TILE_SIZE_PIXELS :
+                        map->tiles[(b / MAP_TILE_SIZE_PIXELS) * map->size_tiles + a / MAP_TILE_SIZE_PIXELS] + 
+                            (b % MAP_TILE_SIZE_PIXELS) * MAP_TILE_SIZE_PIXELS + a % MAP_TILE_SIZE_PIXELS;
+                    
+                    /* Integration into the map */
+                    *ptr = ((256 - alpha) * (*ptr) + alpha * (pixval >> PIXEL_SHIFT) + PIXEL_ROUNDING) >> 8;
+                    
+                    if (error > 0)
                     {
-                        pixval -= incv;
-                        errorv -= incerrorv;
-                        if (errorv < 0)
-                        {
-                            pixval -= sincv;
-                            errorv += derrorv;
-                        }
+                        minor++;
+                        error += diago;
+                    } else
+                    {
+                        error += horiz;
                     }
                 }
+            }
+        }
+    }
+}
+
+
+static int
+        min_pixel(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+/* Recomputes the pyramid over the full-resolution pixel box [xmin,xmax] x [ymin,ymax] */
+static void
+        pyramid_update(
+        map_t * map,
+        int xmin,
+        int ymin,
+        int xmax,
+        int ymax)
+{
+    map_t * finer = map;
+    
+    int k = 0;
+    for (k=0; k<map->pyramid_levels; ++k)
+    {
+        map_t * level = &map->pyramid[k];
+        
+        xmin >>= 1;
+        ymin >>= 1;
+        xmax >>= 1;
+        ymax >>= 1;
+        
+        int y = 0;
+        for (y=ymin; y<=ymax; ++y)
+        {
+            int x = 0;
+            for (x=xmin; x<=xmax; ++x)
+            {
+                /* Min-pool the (up to) four finer pixels covered by this one */
+                int fx = 2 * x;
+                int fy = 2 * y;
                 
-                /* Integration into the map */
-                *ptr = ((256 - alpha) * (*ptr) + alpha * pixval) >> 8;
+                int value = map_pixel(finer, fx, fy);
                 
-                if (error > 0)
+                if (fx + 1 < finer->size_pixels)
                 {
-                    ptr += incptry;
-                    error += diago;
-                } else
+                    value = min_pixel(value, map_pixel(finer, fx+1, fy));
+                }
+                
+                if (fy + 1 < finer->size_pixels)
                 {
-                    error += horiz;
+                    value = min_pixel(value, map_pixel(finer, fx, fy+1));
+                    
+                    if (fx + 1 < finer->size_pixels)
+                    {
+                        value = min_pixel(value, map_pixel(finer, fx+1, fy+1));
+                    }
                 }
+                
+                map_set_pixel(level, x, y, value);
             }
         }
+        
+        finer = level;
     }
 }
 
-
 static void
         scan_update_xy(
         scan_t * scan,
@@ -310,78 +708,833 @@ static void
         int distance,
         int scanval,
         double horz_mm,
-        double rotation)
+        int corrected)
 {
     int j;
     for (j=0; j<scan->span; ++j)
     {
-        double k = (double)(offset*scan->span+j) * scan->detection_angle_degrees / (scan->size * scan->span - 1);
-        double angle = radians(-scan->detection_angle_degrees/2 + k * rotation);
-        double x = distance * cos(angle) - k * horz_mm;
-        double y = distance * sin(angle);
+        int m = offset*scan->span+j;
+        double k = (double)m * scan->detection_angle_degrees / (scan->size * scan->span - 1);
+        double c = scan->cos_angle[m];
+        double s = scan->sin_angle[m];
+        
+        /* Rotate by the velocity correction, using angle addition */
+        if (corrected)
+        {
+            double cc = scan->cos_correction[m];
+            double sc = scan->sin_correction[m];
+            double cs = c * cc - s * sc;
+            
+            s = s * cc + c * sc;
+            c = cs;
+        }
+        
+        double x = distance * c - k * horz_mm;
+        double y = distance * s;
         
         scan->value[scan->npoints] = scanval;
         
         scan->x_mm[scan->npoints] = x;
         scan->y_mm[scan->npoints] = y;
         scan->npoints++;
+        
+        /* Store obstacles separately for SIMD */
+        if (scanval == OBSTACLE)
+        {
+            scan->obst_x_mm[scan->obst_npoints] = (float)x;
+            scan->obst_y_mm[scan->obst_npoints] = (float)y;
+            scan->obst_npoints++;
+            
+            /* Squared until scan_update() has seen every point, to take one square root */
+            double reach_sq_mm = x * x + y * y;
+            if (reach_sq_mm > scan->obst_reach_mm)
+            {
+                scan->obst_reach_mm = reach_sq_mm;
+            }
+        }
     }
 }
 
-
-/* Exported functions --------------------------------------------------------*/
-
-int *
-        int_alloc(
-        int size)
+/* Fills the tables of cosine and sine of the change to each point angle for a scan 
+   rotation factor other than 1, by stepping a unit vector around the circle.  Rounding 
+   error grows with the number of steps; for scans of up to 6000 points, point positions 
+   agree with computing cos() and sin() of each angle to within 1e-6 mm at ranges up 
+   to 100 m (with no rotation correction they are identical). */
+static void
+        scan_correction_tables(
+        scan_t * scan,
+        double rotation)
 {
-    return (int *)safe_malloc(size * sizeof(int));
+    int n = scan->size * scan->span;
+    
+    /* Angle of point m is -detection_angle/2 + k*rotation, so the change is k*(rotation-1) */
+    double step = radians(scan->detection_angle_degrees / (n - 1) * (rotation - 1));
+    double cos_step = cos(step);
+    double sin_step = sin(step);
+    
+    double c = 1;
+    double s = 0;
+    
+    int m = 0;
+    for (m=0; m<n; ++m)
+    {
+        scan->cos_correction[m] = c;
+        scan->sin_correction[m] = s;
+        
+        double cs = c * cos_step - s * sin_step;
+        s = s * cos_step + c * sin_step;
+        c = cs;
+    }
 }
 
-float *
-        float_alloc(
-        int size)
-{
-    return (float *)safe_malloc(size * sizeof(float));
-}
+/* For branch-and-bound search ------------------------------------ */
 
-void
-        map_init(
-        map_t * map,
-        int size_pixels,
-        double size_meters)
-{
-    int npix = size_pixels * size_pixels;
+typedef struct bnb_search {
 
-    int k = 0;
+    map_t * map;
     
-    map->pixels = (pixel_t *)safe_malloc(npix * sizeof(pixel_t));
+    /* full-resolution pixel of each obstacle point, at each rotation, with no translation */
+    int * base_x;
+    int * base_y;
+    int npoints;
+    
+    int window_pixels;
+    
+    int best_distance;
+    int best_rotation;
+    int best_dx;
+    int best_dy;
+
+} bnb_search_t;
+
+typedef struct bnb_candidate {
+
+    int rotation;
+    int dx;   /* first translation in the block */
+    int dy;
+    int bound;
+
+} bnb_candidate_t;
+
+static int bnb_compar(const void * v1, const void * v2)
+{
+    bnb_candidate_t * c1 = (bnb_candidate_t *)v1;
+    bnb_candidate_t * c2 = (bnb_candidate_t *)v2;
     
-    for (k=0; k<npix; ++k)
+    if (c1->bound != c2->bound)
     {
-        map->pixels[k] = (OBSTACLE + NO_OBSTACLE) / 2;
+        return c1->bound < c2->bound ? -1 : 1;
     }
     
-    map->size_pixels = size_pixels;
-    map->size_meters = size_meters;
+    /* Break ties by position in window, so results don't depend on qsort */
+    if (c1->rotation != c2->rotation)
+    {
+        return c1->rotation < c2->rotation ? -1 : 1;
+    }
     
-    /* precompute scale for efficiency */
-    map->scale_pixels_per_mm =  size_pixels / (size_meters * 1000);
+    if (c1->dy != c2->dy)
+    {
+        return c1->dy < c2->dy ? -1 : 1;
+    }
+    
+    return c1->dx < c2->dx ? -1 : c1->dx > c2->dx ? 1 : 0;
 }
 
-void
-        map_free(
-        map_t * map)
+/* Returns a lower bound on the distance for every translation in the square block of 
+   2^level pixels starting at (dx, dy), or -1 if no point can be in the map.  At level 0 
+   this is the exact distance. */
+static int
+        bnb_bound(
+        bnb_search_t * search,
+        int level,
+        int rotation,
+        int dx,
+        int dy)
 {
-    free(map->pixels);
+    map_t * grid = level ? &search->map->pyramid[level-1] : search->map;
+    int size = search->map->size_pixels;
+    int width = 1 << level;
+    
+    int * base_x = search->base_x + rotation * search->npoints;
+    int * base_y = search->base_y + rotation * search->npoints;
+    
+    int64_t sum = 0;
+    int npoints = 0;
+    
+    int i = 0;
+    for (i=0; i<search->npoints; ++i)
+    {
+        /* Range of full-resolution pixels this point covers over the block */
+        int x0 = base_x[i] + dx;
+        int y0 = base_y[i] + dy;
+        int x1 = x0 + width - 1;
+        int y1 = y0 + width - 1;
+        
+        /* Never in map bounds */
+        if (x1 < 0 || x0 >= size || y1 < 0 || y0 >= size)
+        {
+            continue;
+        }
+        
+        npoints++;
+        
+        /* Sometimes in map bounds: counts toward npoints with a bound of zero */
+        if (x0 < 0 || x1 >= size || y0 < 0 || y1 >= size)
+        {
+            continue;
+        }
+        
+        /* The range overlaps at most two coarse pixels in each direction */
+        x0 >>= level;
+        y0 >>= level;
+        x1 >>= level;
+        y1 >>= level;
+        
+        sum += min_pixel(min_pixel(map_pixel(grid, x0, y0), map_pixel(grid, x1, y0)), 
+                         min_pixel(map_pixel(grid, x0, y1), map_pixel(grid, x1, y1)));
+    }
+    
+    return npoints ? (int)(sum * 1024 / npoints) : -1;
 }
 
-void map_string(
+/* Depth-first search of a block, visiting the most promising sub-blocks first */
+static void
+        bnb_branch(
+        bnb_search_t * search,
+        int level,
+        bnb_candidate_t candidate)
+{
+    /* -1 indicates infinity */
+    if (candidate.bound < 0 || candidate.bound >= search->best_distance)
+    {
+        return;
+    }
+    
+    if (level == 0)
+    {
+        search->best_distance = candidate.bound;
+        search->best_rotation = candidate.rotation;
+        search->best_dx = candidate.dx;
+        search->best_dy = candidate.dy;
+        return;
+    }
+    
+    bnb_candidate_t children[4];
+    int nchildren = 0;
+    int half = 1 << (level - 1);
+    
+    int k = 0;
+    for (k=0; k<4; ++k)
+    {
+        bnb_candidate_t child = candidate;
+        child.dx += (k & 1) * half;
+        child.dy += (k >> 1) * half;
+        
+        /* Skip sub-blocks wholly outside the window */
+        if (child.dx <= search->window_pixels && child.dy <= search->window_pixels)
+        {
+            child.bound = bnb_bound(search, level-1, child.rotation, child.dx, child.dy);
+            
+            /* Insertion sort by bound */
+            int j = nchildren++;
+            for (; j>0 && children[j-1].bound > child.bound; --j)
+            {
+                children[j] = children[j-1];
+            }
+            children[j] = child;
+        }
+    }
+    
+    for (k=0; k<nchildren; ++k)
+    {
+        bnb_branch(search, level-1, children[k]);
+    }
+}
+
+/* Run-time selection of distance_scan_to_map kernel -------------- */
+
+typedef int (*distance_kernel_t)(map_t *, scan_t *, position_t);
+
+typedef void (*distance_batch_kernel_t)(map_t *, scan_t *, position_t *, int, int *);
+
+typedef int (*distance_bounded_kernel_t)(map_t *, scan_t *, position_t, int);
+
+typedef int (*distance_rotated_kernel_t)(map_t *, int *, int *, int, int, int, int, int, int);
+
+typedef struct kernel_info {
+
+    const char * name;
+    distance_kernel_t kernel;
+    distance_batch_kernel_t batch_kernel;     /* NULL to score positions one at a time */
+    distance_bounded_kernel_t bounded_kernel; /* NULL to always score every point */
+    distance_rotated_kernel_t rotated_kernel; /* NULL to use the sisd one */
+    int (*supported)(void);
+
+} kernel_info_t;
+
+static int cpu_always(void)
+{
+    return 1;
+}
+
+#ifdef CORESLAM_X86
+
+static void cpuid(int leaf, int regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex(regs, leaf, 0);
+#else
+    __asm__ __volatile__ ("cpuid" 
+                          : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) 
+                          : "a"(leaf), "c"(0));
+#endif
+}
+
+/* Returns the register-state bits the OS saves on context switch (XCR0) */
+static int64_t xgetbv0(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((int64_t)edx << 32) | eax;
+#endif
+}
+
+static int cpu_sse3(void)
+{
+    int regs[4];
+    cpuid(1, regs);
+    return (regs[2] & (1 << 0)) != 0;
+}
+
+/* AVX needs CPU support plus OS support for saving YMM registers */
+static int cpu_avx(int64_t xcr0_mask)
+{
+    int regs[4];
+    cpuid(1, regs);
+    
+    int osxsave = (regs[2] & (1 << 27)) != 0;
+    int avx     = (regs[2] & (1 << 28)) != 0;
+    int fma     = (regs[2] & (1 << 12)) != 0;
+    
+    return osxsave && avx && fma && (xgetbv0() & xcr0_mask) == xcr0_mask;
+}
+
+static int cpu_avx2(void)
+{
+    int regs[4];
+    
+    cpuid(0, regs);
+    if (regs[0] < 7 || !cpu_avx(0x06))
+    {
+        return 0;
+    }
+    
+    cpuid(7, regs);
+    return (regs[1] & (1 << 5)) != 0;
+}
+
+static int cpu_avx512(void)
+{
+    int regs[4];
+    
+    /* AVX-512 also needs OS support for opmask and ZMM registers */
+    if (!cpu_avx2() || !cpu_avx(0xE6))
+    {
+        return 0;
+    }
+    
+    cpuid(7, regs);
+    return (regs[1] & (1 << 16)) != 0;
+}
+
+#endif
+
+/* Fastest first */
+static const kernel_info_t kernels[] = {
+#ifdef CORESLAM_X86
+    { "avx512", distance_scan_to_map_avx512, distance_scan_to_map_batch_avx512, 
+                distance_scan_to_map_bounded_avx512, distance_rotated_scan_to_map_avx512, cpu_avx512 },
+    { "avx2",   distance_scan_to_map_avx2,   distance_scan_to_map_batch_avx2,   
+                distance_scan_to_map_bounded_avx2,   distance_rotated_scan_to_map_avx2,   cpu_avx2 },
+    { "sse",    distance_scan_to_map_sse,    NULL,                              
+                NULL,                                NULL,                                cpu_sse3 },
+#endif
+#ifdef CORESLAM_NEON
+    { "neon",   distance_scan_to_map_neon,   NULL,                              
+                NULL,                                NULL,                                cpu_always },
+#endif
+    { "sisd",   distance_scan_to_map_sisd,   distance_scan_to_map_batch_sisd,   
+                distance_scan_to_map_bounded_sisd,   distance_rotated_scan_to_map_sisd,   cpu_always }
+};
+
+static const int nkernels = sizeof(kernels) / sizeof(kernel_info_t);
+
+static const kernel_info_t * current_kernel = NULL;
+
+static const kernel_info_t * find_kernel(const char * name)
+{
+    int k;
+    for (k=0; k<nkernels; ++k)
+    {
+        if (!strcmp(kernels[k].name, name) && kernels[k].supported())
+        {
+            return &kernels[k];
+        }
+    }
+    
+    return NULL;
+}
+
+/* Picks the fastest supported kernel, unless overridden by BREEZYSLAM_KERNEL */
+static void select_kernel(void)
+{
+    const char * name = getenv("BREEZYSLAM_KERNEL");
+    
+    if (name)
+    {
+        current_kernel = find_kernel(name);
+        
+        if (current_kernel)
+        {
+            return;
+        }
+        
+        fprintf(stderr, "BREEZYSLAM_KERNEL: kernel %s not available; using default\n", name);
+    }
+    
+    int k;
+    for (k=0; k<nkernels; ++k)
+    {
+        if (kernels[k].supported())
+        {
+            current_kernel = &kernels[k];
+            return;
+        }
+    }
+}
+
+/* SIMD kernels gather from dense maps, so sparse maps are scored by the sisd kernel */
+static const kernel_info_t * kernel_for(map_t * map)
+{
+    if (!current_kernel)
+    {
+        select_kernel();
+    }
+    
+    return map->tiles ? &kernels[nkernels-1] : current_kernel;
+}
+
+#ifdef __GNUC__
+/* Select at library load time rather than on first call */
+__attribute__((constructor)) static void select_kernel_at_load(void)
+{
+    if (!current_kernel)
+    {
+        select_kernel();
+    }
+}
+#endif
+
+
+/* Exported functions --------------------------------------------------------*/
+
+int
+        distance_scan_to_map(
+        map_t *  map,
+        scan_t * scan,
+        position_t position)
+{
+    return kernel_for(map)->kernel(map, scan, position);
+}
+
+void
+        distance_scan_to_map_batch(
+        map_t *  map,
+        scan_t * scan,
+        position_t * positions,
+        int npositions,
+        int * distances)
+{
+    const kernel_info_t * kernel = kernel_for(map);
+    
+    if (kernel->batch_kernel)
+    {
+        kernel->batch_kernel(map, scan, positions, npositions, distances);
+    }
+    
+    else
+    {
+        int k;
+        for (k=0; k<npositions; ++k)
+        {
+            distances[k] = kernel->kernel(map, scan, positions[k]);
+        }
+    }
+}
+
+int
+        distance_scan_to_map_bounded(
+        map_t *  map,
+        scan_t * scan,
+        position_t position,
+        int bound)
+{
+    const kernel_info_t * kernel = kernel_for(map);
+    
+    return kernel->bounded_kernel ?
+        kernel->bounded_kernel(map, scan, position, bound) :
+        kernel->kernel(map, scan, position);
+}
+
+/* Scores obstacle points already rotated into fixed-point pixels; see coreslam_internals.h */
+static int
+        distance_rotated_scan_to_map(
+        map_t *  map,
+        int * rotated_x,
+        int * rotated_y,
+        int npoints,
+        int pos_x,
+        int pos_y,
+        int shift,
+        int bound,
+        int in_map)
+{
+    const kernel_info_t * kernel = kernel_for(map);
+    
+    return kernel->rotated_kernel ?
+        kernel->rotated_kernel(map, rotated_x, rotated_y, npoints, pos_x, pos_y, shift, bound, in_map) :
+        distance_rotated_scan_to_map_sisd(map, rotated_x, rotated_y, npoints, pos_x, pos_y, shift, bound, in_map);
+}
+
+int
+        distance_scan_to_map_select(
+        const char * kernel_name)
+{
+    const kernel_info_t * kernel = find_kernel(kernel_name);
+    
+    if (!kernel)
+    {
+        return -1;
+    }
+    
+    current_kernel = kernel;
+    
+    return 0;
+}
+
+const char *
+        distance_scan_to_map_kernel(void)
+{
+    if (!current_kernel)
+    {
+        select_kernel();
+    }
+    
+    return current_kernel->name;
+}
+
+int *
+        int_alloc(
+        int size)
+{
+    return (int *)safe_malloc(size * sizeof(int));
+}
+
+float *
+        float_alloc(
+        int size)
+{
+    return (float *)safe_malloc(size * sizeof(float));
+}
+
+/* How map_init_storage stores the pixels */
+#define STORAGE_DENSE       0
+#define STORAGE_SPARSE      1
+#define STORAGE_EXTERNAL    2   /* caller sets pixels */
+
+/* Extra pixels after a dense map, which let SIMD kernels gather pixels with 32-bit loads */
+static int
+        pixel_padding(void)
+{
+    return sizeof(int) / sizeof(pixel_t) - 1;
+}
+
+/* Sets up a map with every pixel unknown, unless its pixels are stored externally */
+static void
+        map_init_storage(
+        map_t * map,
+        int size_pixels,
+        double size_meters,
+        int storage)
+{
+    int npix = size_pixels * size_pixels;
+
+    int k = 0;
+    
+    map->size_pixels = size_pixels;
+    map->size_meters = size_meters;
+    
+    /* precompute scale for efficiency */
+    map->scale_pixels_per_mm =  size_pixels / (size_meters * 1000);
+    
+    map->pyramid = NULL;
+    map->pyramid_levels = 0;
+    
+    /* version 0 is older than every tile, so asking for changes since then gets the whole map */
+    map->size_tiles = (size_pixels + MAP_TILE_SIZE_PIXELS - 1) / MAP_TILE_SIZE_PIXELS;
+    map->tile_versions = (unsigned *)safe_malloc(map->size_tiles * map->size_tiles * sizeof(unsigned));
+    map->version = 1;
+    
+    for (k=0; k<map->size_tiles*map->size_tiles; ++k)
+    {
+        map->tile_versions[k] = map->version;
+    }
+    
+    map->pixels = NULL;
+    map->tiles = NULL;
+    map->unknown_tile = NULL;
+    map->ntiles_allocated = 0;
+    
+    map->origin_x_mm = 0;
+    map->origin_y_mm = 0;
+    
+    map->mapping = NULL;
+    map->mapping_bytes = 0;
+    map->read_only = 0;
+    
+    if (storage == STORAGE_SPARSE)
+    {
+        map->unknown_tile = (pixel_t *)safe_malloc(MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS * sizeof(pixel_t));
+        
+        for (k=0; k<MAP_TILE_SIZE_PIXELS*MAP_TILE_SIZE_PIXELS; ++k)
+        {
+            map->unknown_tile[k] = ((OBSTACLE + NO_OBSTACLE) / 2) >> PIXEL_SHIFT;
+        }
+        
+        map->tiles = (pixel_t **)safe_malloc(map->size_tiles * map->size_tiles * sizeof(pixel_t *));
+        
+        for (k=0; k<map->size_tiles*map->size_tiles; ++k)
+        {
+            map->tiles[k] = map->unknown_tile;
+        }
+    }
+    
+    else if (storage == STORAGE_DENSE)
+    {
+        int npad = pixel_padding();
+        
+        map->pixels = (pixel_t *)safe_malloc((npix + npad) * sizeof(pixel_t));
+        
+        for (k=0; k<npix+npad; ++k)
+        {
+            map->pixels[k] = ((OBSTACLE + NO_OBSTACLE) / 2) >> PIXEL_SHIFT;
+        }
+    }
+}
+
+void
+        map_init(
+        map_t * map,
+        int size_pixels,
+        double size_meters)
+{
+    map_init_storage(map, size_pixels, size_meters, STORAGE_DENSE);
+}
+
+void
+        map_init_sparse(
+        map_t * map,
+        int size_pixels,
+        double size_meters)
+{
+    map_init_storage(map, size_pixels, size_meters, STORAGE_SPARSE);
+}
+
+void
+        map_free(
+        map_t * map)
+{
+    map_init_pyramid(map, 0);
+    
+    if (map->tiles)
+    {
+        int k = 0;
+        for (k=0; k<map->size_tiles*map->size_tiles; ++k)
+        {
+            if (map->tiles[k] != map->unknown_tile)
+            {
+                free(map->tiles[k]);
+            }
+        }
+        
+        free(map->tiles);
+        free(map->unknown_tile);
+    }
+    
+#ifndef _WIN32
+    if (map->mapping)
+    {
+        munmap(map->mapping, map->mapping_bytes);
+    }
+    else
+#endif
+    {
+        free(map->pixels);
+    }
+    
+    free(map->tile_versions);
+}
+
+void
+        map_init_pyramid(
+        map_t * map,
+        int nlevels)
+{
+    int k = 0;
+    
+    for (k=0; k<map->pyramid_levels; ++k)
+    {
+        map_free(&map->pyramid[k]);
+    }
+    free(map->pyramid);
+    
+    map->pyramid = NULL;
+    map->pyramid_levels = 0;
+    
+    if (nlevels > 0)
+    {
+        map->pyramid = (map_t *)safe_malloc(nlevels * sizeof(map_t));
+        
+        map_t * finer = map;
+        
+        for (k=0; k<nlevels; ++k)
+        {
+            int size_pixels = (finer->size_pixels + 1) / 2;
+            double scale_pixels_per_mm = finer->scale_pixels_per_mm / 2;
+            
+            /* levels of a sparse map are sparse too */
+            map_init_storage(&map->pyramid[k], size_pixels, size_pixels / (scale_pixels_per_mm * 1000), 
+                             map->tiles ? STORAGE_SPARSE : STORAGE_DENSE);
+            
+            /* keep scale an exact power of two below the full-resolution scale */
+            map->pyramid[k].scale_pixels_per_mm = scale_pixels_per_mm;
+            
+            finer = &map->pyramid[k];
+        }
+        
+        map->pyramid_levels = nlevels;
+        
+        pyramid_update(map, 0, 0, map->size_pixels-1, map->size_pixels-1);
+    }
+}
+
+void map_string(
         map_t map,
         char * str)
 {
-    sprintf(str, "size = %d x %d pixels | = %f meters",
-            map.size_pixels, map.size_pixels, map.size_meters);
+    sprintf(str, "size = %d x %d pixels | = %f meters",
+            map.size_pixels, map.size_pixels, map.size_meters);
+}
+
+/* Reports an attempt by caller to change a read-only map */
+static int
+        map_is_read_only(
+        map_t * map,
+        const char * caller)
+{
+    if (map->read_only)
+    {
+        fprintf(stderr, "%s: map is read-only\n", caller);
+    }
+    
+    return map->read_only;
+}
+
+/* Traces the rays of a scan into the map, changing only pixels on rings [ring_start, ring_end)
+   around the position.  Marks and/or allocates the tiles under the whole rays as tile_flags say, 
+   and widens box (xmin, ymin, xmax, ymax) to cover the rays if not NULL. */
+static void
+        map_update_rays(
+        map_t * map,
+        scan_t * scan,
+        position_t position,
+        int map_quality,
+        double hole_width_mm,
+        int ring_start,
+        int ring_end,
+        int tile_flags,
+        int * box)
+{
+    
+    double position_theta_radians = radians(position.theta_degrees);
+    double costheta = cos(position_theta_radians);
+    double sintheta = sin(position_theta_radians);
+    
+    int x1 = roundup(position.x_mm * map->scale_pixels_per_mm);
+    int y1 = roundup(position.y_mm * map->scale_pixels_per_mm);
+    
+    int i = 0;
+    for (i = 0; i != scan->npoints; i++)
+    {        
+        double x2p = costheta * scan->x_mm[i] - sintheta * scan->y_mm[i];
+        double y2p = sintheta * scan->x_mm[i] + costheta * scan->y_mm[i];
+        
+        int xp = roundup((position.x_mm + x2p) * map->scale_pixels_per_mm);
+        int yp = roundup((position.y_mm + y2p) * map->scale_pixels_per_mm);
+        
+        double dist = sqrt(x2p * x2p + y2p * y2p);
+        double add = hole_width_mm / 2 / dist;
+        
+        x2p *= map->scale_pixels_per_mm * (1 + add);
+        y2p *= map->scale_pixels_per_mm * (1 + add);
+        
+        {  
+            int x2 = roundup(position.x_mm * map->scale_pixels_per_mm + x2p);
+            int y2 = roundup(position.y_mm * map->scale_pixels_per_mm + y2p);
+            
+            int value = OBSTACLE;
+            int q = map_quality;
+            
+            if (scan->value[i] == NO_OBSTACLE)
+            {
+                q = map_quality / 4;
+                value = NO_OBSTACLE;
+            }
+            
+            map_laser_ray(map, x1, y1, x2, y2, xp, yp, value, q, ring_start, ring_end, tile_flags);
+            
+            if (box)
+            {
+                box[0] = x2 < box[0] ? x2 : box[0];
+                box[1] = y2 < box[1] ? y2 : box[1];
+                box[2] = x2 > box[2] ? x2 : box[2];
+                box[3] = y2 > box[3] ? y2 : box[3];
+            }
+        }
+    }
+}
+
+/* Recomputes the pyramid over a box of full-resolution pixels, clipped to the map */
+static void
+        pyramid_update_box(
+        map_t * map,
+        int * box)
+{
+    if (map->pyramid_levels)
+    {
+        int xmin = box[0] < 0 ? 0 : box[0];
+        int ymin = box[1] < 0 ? 0 : box[1];
+        int xmax = box[2] >= map->size_pixels ? map->size_pixels-1 : box[2];
+        int ymax = box[3] >= map->size_pixels ? map->size_pixels-1 : box[3];
+        
+        if (xmin <= xmax && ymin <= ymax)
+        {
+            pyramid_update(map, xmin, ymin, xmax, ymax);
+        }
+    }
 }
 
 void
@@ -392,45 +1545,136 @@ void
         int map_quality,
         double hole_width_mm)
 {
+    if (map_is_read_only(map, "map_update"))
+    {
+        return;
+    }
+    
+    int x1 = roundup(position.x_mm * map->scale_pixels_per_mm);
+    int y1 = roundup(position.y_mm * map->scale_pixels_per_mm);
+    
+    /* box of pixels touched, for updating pyramid */
+    int box[4] = {x1, y1, x1, y1};
+    
+    map->version++;
+    
+    map_update_rays(map, scan, position, map_quality, hole_width_mm, 0, INT_MAX, MARK_TILES | ALLOCATE_TILES, box);
+    
+    pyramid_update_box(map, box);
+}
+
+void
+        map_update_rings(
+        map_t * map,
+        scan_t * scan,
+        position_t position,
+        int map_quality,
+        double hole_width_mm,
+        int ring_start,
+        int ring_end)
+{
+    if (map_is_read_only(map, "map_update_rings"))
+    {
+        return;
+    }
     
+    map_update_rays(map, scan, position, map_quality, hole_width_mm, ring_start, ring_end, 0, NULL);
+}
+
+void
+        map_update_ring_bounds(
+        map_t * map,
+        scan_t * scan,
+        position_t position,
+        double hole_width_mm,
+        int nparts,
+        int * bounds)
+{
     double position_theta_radians = radians(position.theta_degrees);
     double costheta = cos(position_theta_radians);
     double sintheta = sin(position_theta_radians);
     
-    int x1 = roundup(position.x_mm * map->scale_pixels_per_mm);
-    int y1 = roundup(position.y_mm * map->scale_pixels_per_mm);
+    /* No ray is longer than the map diagonal, in rings */
+    int nrings = map->size_pixels + 1;
+    int * counts = int_alloc(nrings + 1);
+    memset(counts, 0, (nrings + 1) * sizeof(int));
     
+    /* Count rays by number of rings they cross */
     int i = 0;
     for (i = 0; i != scan->npoints; i++)
     {        
         double x2p = costheta * scan->x_mm[i] - sintheta * scan->y_mm[i];
         double y2p = sintheta * scan->x_mm[i] + costheta * scan->y_mm[i];
         
-        int xp = roundup((position.x_mm + x2p) * map->scale_pixels_per_mm);
-        int yp = roundup((position.y_mm + y2p) * map->scale_pixels_per_mm);
-        
         double dist = sqrt(x2p * x2p + y2p * y2p);
-        double add = hole_width_mm / 2 / dist;
+        double length = (dist + hole_width_mm / 2) * map->scale_pixels_per_mm;
         
-        x2p *= map->scale_pixels_per_mm * (1 + add);
-        y2p *= map->scale_pixels_per_mm * (1 + add);
+        int rings = (int)(fabs(x2p) > fabs(y2p) ? length * fabs(x2p) / dist : length * fabs(y2p) / dist) + 2;
         
-        {  
-            int x2 = roundup(position.x_mm * map->scale_pixels_per_mm + x2p);
-            int y2 = roundup(position.y_mm * map->scale_pixels_per_mm + y2p);
-            
-            int value = OBSTACLE;
-            int q = map_quality;
-            
-            if (scan->value[i] == NO_OBSTACLE)
-            {
-                q = map_quality / 4;
-                value = NO_OBSTACLE;
-            }
-            
-            map_laser_ray(map->pixels, map->size_pixels, x1, y1, x2, y2, xp, yp, value, q);
+        counts[rings < nrings ? rings : nrings]++;
+    }
+    
+    /* Tiles of a sparse map cannot be allocated by the threads updating it */
+    if (map->tiles && !map_is_read_only(map, "map_update_ring_bounds"))
+    {
+        map_update_rays(map, scan, position, 0, hole_width_mm, 0, 0, ALLOCATE_TILES, NULL);
+    }
+    
+    /* Work on ring t is the number of rays reaching it */
+    int64_t total = 0;
+    int reaching = 0;
+    int t = 0;
+    for (t=nrings; t>=0; --t)
+    {
+        reaching += counts[t];
+        counts[t] = reaching;
+        total += reaching;
+    }
+    
+    /* Split rings so each part gets about the same work */
+    int k = 0;
+    int64_t done = 0;
+    bounds[0] = 0;
+    for (t=0, k=1; t<=nrings && k<nparts; ++t)
+    {
+        done += counts[t];
+        
+        if (done * nparts >= total * k)
+        {
+            bounds[k++] = t + 1;
         }
     }
+    for (; k<=nparts; ++k)
+    {
+        bounds[k] = k < nparts ? nrings + 1 : INT_MAX;
+    }
+    
+    free(counts);
+}
+
+void
+        map_update_finish(
+        map_t * map,
+        scan_t * scan,
+        position_t position,
+        double hole_width_mm)
+{
+    if (map_is_read_only(map, "map_update_finish"))
+    {
+        return;
+    }
+    
+    int x1 = roundup(position.x_mm * map->scale_pixels_per_mm);
+    int y1 = roundup(position.y_mm * map->scale_pixels_per_mm);
+    
+    int box[4] = {x1, y1, x1, y1};
+    
+    map->version++;
+    
+    /* An empty ring range changes no pixels, but marks the same tiles and box as map_update */
+    map_update_rays(map, scan, position, 0, hole_width_mm, 0, 0, MARK_TILES, box);
+    
+    pyramid_update_box(map, box);
 }
 
 void
@@ -439,10 +1683,29 @@ void
         char * bytes)
 {
     int k;
-    for (k=0; k<map->size_pixels*map->size_pixels; ++k)
+    
+    if (map->tiles)
+    {
+        for (k=0; k<map->size_pixels*map->size_pixels; ++k)
+        {
+            bytes[k] = map_pixel(map, k % map->size_pixels, k / map->size_pixels) >> (8 - PIXEL_SHIFT);
+        }
+    }
+    
+#ifdef BREEZYSLAM_MAP8
+    else
+    {
+        memcpy(bytes, map->pixels, map->size_pixels*map->size_pixels);
+    }
+#else
+    else
     {
-        bytes[k] = map->pixels[k] >> 8;
+        for (k=0; k<map->size_pixels*map->size_pixels; ++k)
+        {
+            bytes[k] = map->pixels[k] >> 8;
+        }
     }
+#endif
 }
 
 
@@ -451,12 +1714,331 @@ void
         map_t * map,
         char * bytes)
 {
+    if (map_is_read_only(map, "map_set"))
+    {
+        return;
+    }
+    
     int k;
     for (k=0; k<map->size_pixels*map->size_pixels; ++k)
     {
-        map->pixels[k] = bytes[k];
-        map->pixels[k] <<= 8;
+        pixel_t value = bytes[k];
+        value <<= 8 - PIXEL_SHIFT;
+        
+        map_set_pixel(map, k % map->size_pixels, k / map->size_pixels, value);
+    }
+    
+    pyramid_update(map, 0, 0, map->size_pixels-1, map->size_pixels-1);
+    
+    map->version++;
+    
+    for (k=0; k<map->size_tiles*map->size_tiles; ++k)
+    {
+        map->tile_versions[k] = map->version;
+    }
+}
+
+int
+        map_get_tiles(
+        map_t * map,
+        unsigned since_version,
+        int * tiles,
+        char * bytes)
+{
+    int ntiles = 0;
+    
+    int t = 0;
+    for (t=0; t<map->size_tiles*map->size_tiles; ++t)
+    {
+        if (map->tile_versions[t] > since_version)
+        {
+            int x0 = (t % map->size_tiles) * MAP_TILE_SIZE_PIXELS;
+            int y0 = (t / map->size_tiles) * MAP_TILE_SIZE_PIXELS;
+            
+            /* tiles on the right and bottom edges can stick out of the map */
+            int width  = map->size_pixels - x0 < MAP_TILE_SIZE_PIXELS ? map->size_pixels - x0 : MAP_TILE_SIZE_PIXELS;
+            int height = map->size_pixels - y0 < MAP_TILE_SIZE_PIXELS ? map->size_pixels - y0 : MAP_TILE_SIZE_PIXELS;
+            
+            char * tile_bytes = bytes + ntiles * MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS;
+            
+            memset(tile_bytes, 0, MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS);
+            
+            int y = 0;
+            for (y=0; y<height; ++y)
+            {
+                int x = 0;
+                for (x=0; x<width; ++x)
+                {
+                    tile_bytes[y * MAP_TILE_SIZE_PIXELS + x] = map_pixel(map, x0 + x, y0 + y) >> (8 - PIXEL_SHIFT);
+                }
+            }
+            
+            tiles[ntiles++] = t;
+        }
+    }
+    
+    return ntiles;
+}
+
+/* Map files ------------------------------------------------------------------ */
+
+#define MAP_FILE_MAGIC          "BZSLMAP"
+#define MAP_FILE_VERSION        2
+
+/* Fields and pixels are stored in the byte order of the machine that saved the map; this value 
+   reads back differently on a machine with the other order */
+#define MAP_FILE_BYTE_ORDER     0x01020304
+
+/* Pixels start at a page boundary so that they can be mapped straight into memory */
+#define MAP_FILE_PIXELS_OFFSET  4096
+
+typedef struct map_file_header {
+    
+    char magic[8];
+    uint32_t format_version;
+    uint32_t byte_order;
+    uint32_t pixels_offset;
+    int32_t size_pixels;
+    uint32_t pixel_bytes;
+    double size_meters;
+    double origin_x_mm;
+    double origin_y_mm;
+    
+} map_file_header_t;
+
+int
+        map_save(
+        map_t * map,
+        const char * filename)
+{
+    FILE * file = fopen(filename, "wb");
+    
+    if (!file)
+    {
+        return -1;
+    }
+    
+    char page[MAP_FILE_PIXELS_OFFSET];
+    memset(page, 0, MAP_FILE_PIXELS_OFFSET);
+    
+    map_file_header_t * header = (map_file_header_t *)page;
+    strcpy(header->magic, MAP_FILE_MAGIC);
+    header->format_version = MAP_FILE_VERSION;
+    header->byte_order = MAP_FILE_BYTE_ORDER;
+    header->pixels_offset = MAP_FILE_PIXELS_OFFSET;
+    header->size_pixels = map->size_pixels;
+    header->pixel_bytes = sizeof(pixel_t);
+    header->size_meters = map->size_meters;
+    header->origin_x_mm = map->origin_x_mm;
+    header->origin_y_mm = map->origin_y_mm;
+    
+    int ok = fwrite(page, 1, MAP_FILE_PIXELS_OFFSET, file) == MAP_FILE_PIXELS_OFFSET;
+    
+    /* Padding is saved too, so that a mapped file can be gathered from like any dense map */
+    int npad = pixel_padding();
+    pixel_t padding[4] = {0, 0, 0, 0};
+    
+    if (map->tiles)
+    {
+        pixel_t * row = (pixel_t *)safe_malloc(map->size_pixels * sizeof(pixel_t));
+        
+        int y = 0;
+        for (y=0; y<map->size_pixels && ok; ++y)
+        {
+            int x = 0;
+            for (x=0; x<map->size_pixels; ++x)
+            {
+                row[x] = map_pixel(map, x, y);
+            }
+            
+            ok = fwrite(row, sizeof(pixel_t), map->size_pixels, file) == (size_t)map->size_pixels;
+        }
+        
+        free(row);
+        
+        ok = ok && fwrite(padding, sizeof(pixel_t), npad, file) == (size_t)npad;
+    }
+    
+    else
+    {
+        size_t npix = (size_t)map->size_pixels * map->size_pixels + npad;
+        
+        ok = ok && fwrite(map->pixels, sizeof(pixel_t), npix, file) == npix;
+    }
+    
+    return (fclose(file) == 0 && ok) ? 0 : -1;
+}
+
+int
+        map_open(
+        map_t * map,
+        const char * filename,
+        int mode)
+{
+    if (mode != MAP_OPEN_COPY && mode != MAP_OPEN_READ_ONLY && mode != MAP_OPEN_COPY_ON_WRITE)
+    {
+        return -1;
+    }
+    
+    FILE * file = fopen(filename, "rb");
+    
+    if (!file)
+    {
+        return -1;
+    }
+    
+    map_file_header_t header;
+    
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        strncmp(header.magic, MAP_FILE_MAGIC, sizeof(header.magic)) ||
+        header.format_version != MAP_FILE_VERSION ||
+        header.byte_order != MAP_FILE_BYTE_ORDER ||
+        header.pixels_offset != MAP_FILE_PIXELS_OFFSET ||
+        header.pixel_bytes != sizeof(pixel_t) ||
+        header.size_pixels <= 0)
+    {
+        fprintf(stderr, "map_open: %s is not a map file for this build\n", filename);
+        fclose(file);
+        return -1;
+    }
+    
+    size_t npix = (size_t)header.size_pixels * header.size_pixels + pixel_padding();
+    size_t nbytes = header.pixels_offset + npix * sizeof(pixel_t);
+    
+    map_init_storage(map, header.size_pixels, header.size_meters, STORAGE_EXTERNAL);
+    
+    map->origin_x_mm = header.origin_x_mm;
+    map->origin_y_mm = header.origin_y_mm;
+    
+#ifndef _WIN32
+    if (mode != MAP_OPEN_COPY)
+    {
+        struct stat info;
+        
+        if (fstat(fileno(file), &info) == 0 && (size_t)info.st_size >= nbytes)
+        {
+            map->mapping = mmap(NULL, nbytes, 
+                                mode == MAP_OPEN_READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE, 
+                                mode == MAP_OPEN_READ_ONLY ? MAP_SHARED : MAP_PRIVATE, 
+                                fileno(file), 0);
+        }
+        
+        if (!map->mapping || map->mapping == MAP_FAILED)
+        {
+            map->mapping = NULL;
+            map_free(map);
+            fclose(file);
+            return -1;
+        }
+        
+        map->mapping_bytes = nbytes;
+        map->pixels = (pixel_t *)((char *)map->mapping + header.pixels_offset);
+        map->read_only = mode == MAP_OPEN_READ_ONLY;
+        
+        fclose(file);
+        
+        return 0;
+    }
+#endif
+    
+    /* Without mmap, every mode reads the pixels into memory */
+    map->pixels = (pixel_t *)safe_malloc(npix * sizeof(pixel_t));
+    
+    if (fseek(file, header.pixels_offset, SEEK_SET) || fread(map->pixels, sizeof(pixel_t), npix, file) != npix)
+    {
+        map_free(map);
+        fclose(file);
+        return -1;
+    }
+    
+    map->read_only = mode == MAP_OPEN_READ_ONLY;
+    
+    fclose(file);
+    
+    return 0;
+}
+
+/* Obstacle points rotated to angle bins ----------------------------------------- */
+
+/* With RMHC_SEARCH_ROTATED_BINS, late in a search candidates fall into a few angle bins, and 
+   the parallel chains and pyramid levels searching one scan visit mostly the same ones.  Each 
+   scan therefore keeps the obstacle points rotated to the centers of the bins visited, in 
+   full-resolution fixed-point pixels, in a direct-mapped table of slots that scan_update() 
+   empties.  A search claims an empty slot for its bin with an atomic compare-and-swap and 
+   publishes the points once rotated; a search finding its slot busy or holding another bin 
+   rotates into a buffer of its own.  The points are a function of the bin, the scan, and the 
+   map scale only, so results do not depend on which search rotated them. */
+#define ROTATION_CACHE_SIZE     256
+#define ROTATION_EMPTY          LONG_MIN
+
+#ifdef _MSC_VER
+#define atomic_load_acquire(p)          _InterlockedOr((volatile long *)(p), 0)
+#define atomic_store_release(p, v)      _InterlockedExchange((volatile long *)(p), (v))
+#define atomic_claim(p, expected, v)    (_InterlockedCompareExchange((volatile long *)(p), (v), (expected)) == (expected))
+#else
+#define atomic_load_acquire(p)          __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store_release(p, v)      __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_claim(p, expected, v)    __sync_bool_compare_and_swap((p), (expected), (v))
+#endif
+
+typedef struct rotation_slot_t
+{
+    volatile long bin;      /* ROTATION_EMPTY until a search claims the slot */
+    volatile long ready;    /* nonzero once the points are rotated */
+    double scale;           /* pixels per mm of the full-resolution map the points are for */
+    int * x;                /* allocated on first use, for up to size * span points */
+    int * y;
+    
+} rotation_slot_t;
+
+typedef struct rotation_cache_t
+{
+    rotation_slot_t slots[ROTATION_CACHE_SIZE];
+    
+} rotation_cache_t;
+
+/* Empties every slot, keeping their point buffers */
+static void
+        rotation_cache_clear(
+        rotation_cache_t * cache)
+{
+    int k = 0;
+    for (k=0; k<ROTATION_CACHE_SIZE; ++k)
+    {
+        cache->slots[k].bin = ROTATION_EMPTY;
+        cache->slots[k].ready = 0;
+    }
+}
+
+static rotation_cache_t *
+        rotation_cache_alloc(void)
+{
+    rotation_cache_t * cache = (rotation_cache_t *)safe_malloc(sizeof(rotation_cache_t));
+    
+    int k = 0;
+    for (k=0; k<ROTATION_CACHE_SIZE; ++k)
+    {
+        cache->slots[k].x = NULL;
+        cache->slots[k].y = NULL;
+    }
+    
+    rotation_cache_clear(cache);
+    
+    return cache;
+}
+
+static void
+        rotation_cache_free(
+        rotation_cache_t * cache)
+{
+    int k = 0;
+    for (k=0; k<ROTATION_CACHE_SIZE; ++k)
+    {
+        free(cache->slots[k].x);
+        free(cache->slots[k].y);
     }
+    
+    free(cache);
 }
 
 void scan_init(
@@ -483,17 +2065,39 @@ void scan_init(
     
     scan->npoints = 0;
     scan->obst_npoints = 0;
+    scan->obst_reach_mm = 0;
+    
+    scan->rotations = rotation_cache_alloc();
 
     /* for angle/distance interpolation */
     interpolation_t * interp = (interpolation_t *)safe_malloc(sizeof(interpolation_t));
     interp->angles = float_alloc(scan->size);
     interp->distances = float_alloc(scan->size);
     interp->angle_distance_pairs = (angle_distance_pair_t *)safe_malloc(size*sizeof(angle_distance_pair_t));
+    interp->merge_buffer = (angle_distance_pair_t *)safe_malloc(size*sizeof(angle_distance_pair_t));
+    interp->resampled_mm = int_alloc(scan->size);
     scan->interpolation = interp;
     
     /* assure size multiple of 4 for SSE */
     scan->obst_x_mm = float_alloc(size*span+4);
     scan->obst_y_mm = float_alloc(size*span+4);
+    scan->obst_scratch_x_mm = float_alloc(size*span+4);
+    scan->obst_scratch_y_mm = float_alloc(size*span+4);
+    
+    /* Ray angles are fixed by the laser parameters, so compute their trigonometry once */
+    scan->cos_angle = double_alloc(size*span);
+    scan->sin_angle = double_alloc(size*span);
+    scan->cos_correction = double_alloc(size*span);
+    scan->sin_correction = double_alloc(size*span);
+    
+    int m = 0;
+    for (m=0; m<size*span; ++m)
+    {
+        double k = (double)m * scan->detection_angle_degrees / (scan->size * scan->span - 1);
+        double angle = radians(-scan->detection_angle_degrees/2 + k);
+        scan->cos_angle[m] = cos(angle);
+        scan->sin_angle[m] = sin(angle);
+    }
 }
 
 
@@ -507,12 +2111,23 @@ void
     
     free(scan->obst_x_mm);
     free(scan->obst_y_mm);
+    free(scan->obst_scratch_x_mm);
+    free(scan->obst_scratch_y_mm);
+    
+    free(scan->cos_angle);
+    free(scan->sin_angle);
+    free(scan->cos_correction);
+    free(scan->sin_correction);
 
     interpolation_t * interp = (interpolation_t *)scan->interpolation;
     free(interp->angles);
     free(interp->distances);
     free(interp->angle_distance_pairs);
+    free(interp->merge_buffer);
+    free(interp->resampled_mm);
     free(interp);
+    
+    rotation_cache_free((rotation_cache_t *)scan->rotations);
 }
 
 void scan_string(
@@ -522,6 +2137,57 @@ void scan_string(
     sprintf(str, "%d obstacle points | %d free points", scan.obst_npoints, scan.npoints-scan.obst_npoints);
 }
 
+/* Reorders obstacle points so that every prefix samples the whole scan (bit-reversed index
+   order), letting bounded distance kernels reject a position after a few points.  The points are
+   written to the scratch buffers of the scan, which then trade places with the obstacle buffers. */
+static void
+        stratify_obstacles(
+        scan_t * scan)
+{
+    int n = scan->obst_npoints;
+    
+    if (n < 2)
+    {
+        return;
+    }
+    
+    int bits = 0;
+    while ((1 << bits) < n)
+    {
+        bits++;
+    }
+    
+    float * x_mm = scan->obst_x_mm;
+    float * y_mm = scan->obst_y_mm;
+    
+    scan->obst_x_mm = scan->obst_scratch_x_mm;
+    scan->obst_y_mm = scan->obst_scratch_y_mm;
+    scan->obst_scratch_x_mm = x_mm;
+    scan->obst_scratch_y_mm = y_mm;
+    
+    int k = 0;
+    int i = 0;  /* bit-reversed counter */
+    int r = 0;
+    for (r=0; r<(1<<bits); ++r)
+    {
+        if (i < n)
+        {
+            scan->obst_x_mm[k] = x_mm[i];
+            scan->obst_y_mm[k] = y_mm[i];
+            k++;
+        }
+        
+        /* Increment i in reversed bit order */
+        int bit = 1 << (bits - 1);
+        while (bit && (i & bit))
+        {
+            i ^= bit;
+            bit >>= 1;
+        }
+        i |= bit;
+    }
+}
+
 void
 scan_update(
         scan_t * scan,
@@ -532,10 +2198,28 @@ scan_update(
         double  velocities_dxy_mm,
         double  velocities_dtheta_degrees)
 {    
+    scan_update_multiple(&scan, 1, lidar_angles_deg, lidar_distances_mm, scan_size, 
+                         hole_width_mm, velocities_dxy_mm, velocities_dtheta_degrees);
+}
+
+void
+scan_update_multiple(
+        scan_t ** scans,
+        int     nscans,
+        float * lidar_angles_deg,
+        int *   lidar_distances_mm,
+        int     scan_size,
+        double  hole_width_mm,
+        double  velocities_dxy_mm,
+        double  velocities_dtheta_degrees)
+{    
+    /* All scans come from the same laser */
+    scan_t * scan = scans[0];
+    
     /* interpolate scan distances by angles if indicated */
     if (lidar_angles_deg) 
     {
-        interpolate_scan(scan, lidar_angles_deg, lidar_distances_mm, scan_size);
+        lidar_distances_mm = interpolate_scan(scan, lidar_angles_deg, lidar_distances_mm, scan_size);
     }
 
     /* Take velocity into account */
@@ -543,12 +2227,26 @@ scan_update(
     double horz_mm = velocities_dxy_mm / degrees_per_second;
     double rotation = 1 + velocities_dtheta_degrees / degrees_per_second;
     
+    int corrected = rotation != 1;
+    
+    int s = 0;
+    for (s=0; s<nscans; ++s)
+    {
+        if (corrected)
+        {
+            scan_correction_tables(scans[s], rotation);
+        }
+        
+        scans[s]->npoints = 0;
+        scans[s]->obst_npoints = 0;
+        scans[s]->obst_reach_mm = 0;
+        
+        rotation_cache_clear((rotation_cache_t *)scans[s]->rotations);
+    }
+    
     /* Span the laser scans to better cover the space */
     int i = 0;
     
-    scan->npoints = 0;
-    scan->obst_npoints = 0;
-    
     for (i=scan->detection_margin+1; i<scan->size-scan->detection_margin; ++i)
     {
         int lidar_value_mm = lidar_distances_mm[i];
@@ -556,47 +2254,348 @@ scan_update(
         /* No obstacle */
         if (lidar_value_mm == 0)
         {
-            scan_update_xy(scan, i, (int)scan->distance_no_detection_mm, NO_OBSTACLE, horz_mm, rotation);
+            for (s=0; s<nscans; ++s)
+            {
+                scan_update_xy(scans[s], i, (int)scan->distance_no_detection_mm, NO_OBSTACLE, horz_mm, corrected);
+            }
         }
         
         /* Obstacle */
         else if (lidar_value_mm > hole_width_mm / 2)
         {
-            int oldstart = scan->npoints;
-         
-            int j = 0;
-            
-            scan_update_xy(scan, i, lidar_value_mm, OBSTACLE, horz_mm, rotation);
-            
-            /* Store obstacles separately for SSE */
-            for (j=oldstart; j<scan->npoints; ++j)
+            for (s=0; s<nscans; ++s)
             {
-                if (scan->value[j] == OBSTACLE)
-                {
-                    scan->obst_x_mm[scan->obst_npoints] = (float)scan->x_mm[j];
-                    scan->obst_y_mm[scan->obst_npoints] = (float)scan->y_mm[j];
-                    scan->obst_npoints++;
-                }
+                scan_update_xy(scans[s], i, lidar_value_mm, OBSTACLE, horz_mm, corrected);
             }
         }
     }
+    
+    for (s=0; s<nscans; ++s)
+    {
+        scans[s]->obst_reach_mm = sqrt(scans[s]->obst_reach_mm);
+        
+        stratify_obstacles(scans[s]);
+    }
 }
 
-position_t
-        rmhc_position_search(
+/* Returns the map to score against at a pyramid level, shifting the position so that 
+   each point rounds to the coarse pixel containing its full-resolution pixel, rather than 
+   to the nearest coarse pixel */
+static map_t *
+        level_map(
+        map_t * map,
+        position_t * position,
+        int level)
+{
+    if (level == 0)
+    {
+        return map;
+    }
+    
+    double shift_mm = (0.5 - 0.5 * (1 << level)) / map->scale_pixels_per_mm;
+    
+    position->x_mm += shift_mm;
+    position->y_mm += shift_mm;
+    
+    return &map->pyramid[level-1];
+}
+
+int
+        distance_scan_to_map_level(
+        map_t *  map,
+        scan_t * scan,
+        position_t position,
+        int level)
+{
+    map_t * grid = level_map(map, &position, level);
+    
+    return distance_scan_to_map(grid, scan, position);
+}
+
+/* Search counters, one set per thread so that parallel searches do not share them */
+#ifdef BREEZYSLAM_STATS
+#ifdef _MSC_VER
+static __declspec(thread) search_stats_t thread_search_stats;
+#else
+static __thread search_stats_t thread_search_stats;
+#endif
+#define COUNT_SEARCH(field, n) (thread_search_stats.field += (n))
+#else
+#define COUNT_SEARCH(field, n)
+#endif
+
+int
+        search_stats_take(
+        search_stats_t * stats)
+{
+#ifdef BREEZYSLAM_STATS
+    *stats = thread_search_stats;
+    memset(&thread_search_stats, 0, sizeof(search_stats_t));
+    return 0;
+#else
+    memset(stats, 0, sizeof(search_stats_t));
+    return -1;
+#endif
+}
+
+/* Late in a search, candidates often round to a pixel and angle already scored.  With 
+   RMHC_SEARCH_CACHE_SCORES, each search level keeps the distances of the last bins scored in a 
+   small direct-mapped table, and answers a candidate in a known bin from it; the bin of an angle
+   is small enough that no scan point moves more than half a pixel within it. */
+#define SEARCH_CACHE_SIZE 1024
+
+/* Angle bins per degree for a search of a grid: half a pixel of arc at the farthest distance
+   the laser reports */
+static double
+        angle_bins_per_degree(
+        map_t * grid,
+        scan_t * scan)
+{
+    double reach_pixels = scan->distance_no_detection_mm * grid->scale_pixels_per_mm;
+    
+    return reach_pixels > 1 ? radians(2 * reach_pixels) : radians(2);
+}
+
+typedef struct search_cache_entry_t
+{
+    int x;
+    int y;
+    int theta;
+    int distance;
+    int valid;
+    
+} search_cache_entry_t;
+
+typedef struct search_cache_t
+{
+    search_cache_entry_t entries[SEARCH_CACHE_SIZE];
+    double pixels_per_mm;
+    double bins_per_degree;
+    
+} search_cache_t;
+
+static void
+        search_cache_init(
+        search_cache_t * cache,
+        map_t * grid,
+        scan_t * scan)
+{
+    memset(cache->entries, 0, sizeof(cache->entries));
+    
+    cache->pixels_per_mm = grid->scale_pixels_per_mm;
+    cache->bins_per_degree = angle_bins_per_degree(grid, scan);
+}
+
+/* Returns the entry for the bin of a position, filling in its key; valid is then nonzero only 
+   if the entry already holds the distance for that bin */
+static search_cache_entry_t *
+        search_cache_find(
+        search_cache_t * cache,
+        position_t position)
+{
+    int x = (int)floor(position.x_mm * cache->pixels_per_mm + 0.5);
+    int y = (int)floor(position.y_mm * cache->pixels_per_mm + 0.5);
+    int theta = (int)floor(position.theta_degrees * cache->bins_per_degree + 0.5);
+    
+    unsigned hash = ((unsigned)x * 73856093U) ^ ((unsigned)y * 19349663U) ^ ((unsigned)theta * 83492791U);
+    search_cache_entry_t * entry = &cache->entries[hash % SEARCH_CACHE_SIZE];
+    
+    if (entry->x != x || entry->y != y || entry->theta != theta)
+    {
+        entry->x = x;
+        entry->y = y;
+        entry->theta = theta;
+        entry->valid = 0;
+    }
+    
+    return entry;
+}
+
+/* Once the angle sigma of a search is small, candidates mostly fall into a few angle bins, and 
+   with RMHC_SEARCH_ROTATED_BINS each is scored at the center of its bin from the points the 
+   scan keeps rotated to it; scoring is then an integer translation and a map lookup per point.  
+   While the sigma still spans more bins than this, candidates are scored by the bounded kernel 
+   instead. */
+#define ROTATION_MAX_SIGMA_BINS 32
+
+typedef struct rotation_search_t
+{
+    rotation_cache_t * cache;   /* NULL to score every candidate at its own angle */
+    map_t * map;                /* full resolution */
+    scan_t * scan;
+    double bins_per_degree;
+    
+    rotation_slot_t own;        /* the last bin no slot of the cache could take */
+    
+} rotation_search_t;
+
+static void
+        rotation_search_init(
+        rotation_search_t * search,
+        map_t * map,
+        scan_t * scan,
+        int options)
+{
+    search->cache = (options & RMHC_SEARCH_ROTATED_BINS) ? (rotation_cache_t *)scan->rotations : NULL;
+    search->map = map;
+    search->scan = scan;
+    search->bins_per_degree = angle_bins_per_degree(map, scan);
+    
+    search->own.bin = ROTATION_EMPTY;
+    search->own.x = NULL;
+    search->own.y = NULL;
+}
+
+static void
+        rotation_search_free(
+        rotation_search_t * search)
+{
+    free(search->own.x);
+    free(search->own.y);
+}
+
+/* Rotates the obstacle points to the center of a bin, into full-resolution fixed-point pixels */
+static void
+        rotation_search_rotate(
+        rotation_search_t * search,
+        rotation_slot_t * slot,
+        long bin)
+{
+    if (!slot->x)
+    {
+        slot->x = int_alloc(search->scan->size * search->scan->span + 1);
+        slot->y = int_alloc(search->scan->size * search->scan->span + 1);
+    }
+    
+    double bin_theta_radians = radians(bin / search->bins_per_degree);
+    double scale = search->map->scale_pixels_per_mm * (1 << ROTATED_FRACTION_BITS);
+    double costheta = cos(bin_theta_radians) * scale;
+    double sintheta = sin(bin_theta_radians) * scale;
+    
+    /* Rounding half away from zero, which unlike floor() the compiler can vectorize */
+    float cos_f = (float)costheta;
+    float sin_f = (float)sintheta;
+    float * x_mm = search->scan->obst_x_mm;
+    float * y_mm = search->scan->obst_y_mm;
+    int * x = slot->x;
+    int * y = slot->y;
+    int npoints = search->scan->obst_npoints;
+    
+    int i = 0;
+    for (i=0; i<npoints; ++i)
+    {
+        float xr = cos_f * x_mm[i] - sin_f * y_mm[i];
+        float yr = sin_f * x_mm[i] + cos_f * y_mm[i];
+        
+        x[i] = (int)(xr + (xr < 0 ? -0.5f : 0.5f));
+        y[i] = (int)(yr + (yr < 0 ? -0.5f : 0.5f));
+    }
+    
+    slot->scale = search->map->scale_pixels_per_mm;
+}
+
+/* Returns a slot holding the obstacle points rotated to the bin of an angle: the scan's slot 
+   for the bin if some search has filled it or this one can claim it, else the search's own */
+static rotation_slot_t *
+        rotation_search_find(
+        rotation_search_t * search,
+        double theta_degrees)
+{
+    long bin = (long)floor(theta_degrees * search->bins_per_degree + 0.5);
+    
+    rotation_slot_t * slot = &search->cache->slots[(unsigned long)bin % ROTATION_CACHE_SIZE];
+    
+    if (atomic_load_acquire(&slot->ready) && slot->bin == bin && slot->scale == search->map->scale_pixels_per_mm)
+    {
+        return slot;
+    }
+    
+    if (slot->bin == ROTATION_EMPTY && atomic_claim(&slot->bin, ROTATION_EMPTY, bin))
+    {
+        rotation_search_rotate(search, slot, bin);
+        atomic_store_release(&slot->ready, 1);
+        
+        return slot;
+    }
+    
+    /* The slot is being filled or holds another bin */
+    if (search->own.bin != bin)
+    {
+        rotation_search_rotate(search, &search->own, bin);
+        search->own.bin = bin;
+    }
+    
+    return &search->own;
+}
+
+/* Scores a position on a pyramid level like distance_scan_to_map_bounded(), with the angle 
+   rounded to its bin once the sigma of the search is small enough */
+static int
+        rotation_search_distance(
+        rotation_search_t * search,
+        map_t * grid,
+        int level,
+        position_t position,
+        double sigma_theta_degrees,
+        int bound)
+{
+    scan_t * scan = search->scan;
+    
+    if (!search->cache || sigma_theta_degrees * search->bins_per_degree > ROTATION_MAX_SIGMA_BINS)
+    {
+        return distance_scan_to_map_bounded(grid, scan, position, bound);
+    }
+    
+    rotation_slot_t * slot = rotation_search_find(search, position.theta_degrees);
+    
+    /* Translation in full-resolution fixed point, plus one half of a grid pixel for rounding */
+    int shift = ROTATED_FRACTION_BITS + level;
+    double scale = search->map->scale_pixels_per_mm * (1 << ROTATED_FRACTION_BITS);
+    int pos_x = (int)floor(position.x_mm * scale + 0.5) + (1 << (shift - 1));
+    int pos_y = (int)floor(position.y_mm * scale + 0.5) + (1 << (shift - 1));
+    
+    int in_map = scan_in_map(grid, scan, 
+                             position.x_mm * grid->scale_pixels_per_mm, 
+                             position.y_mm * grid->scale_pixels_per_mm);
+    
+    return distance_rotated_scan_to_map(grid, slot->x, slot->y, scan->obst_npoints, pos_x, pos_y, shift, bound, 
+                                        in_map);
+}
+
+static position_t
+        rmhc_search_level(
         position_t start_pos,
         map_t * map,
+        int level,
         scan_t * scan,
         double sigma_xy_mm,
         double sigma_theta_degrees,
         int max_search_iter,
-        void * randomizer)
+        void * randomizer,
+        int options,
+        rotation_search_t * rotations)
 {
     position_t currentpos = start_pos;
     position_t bestpos = start_pos;
     position_t lastbestpos = start_pos;
     
-    int current_distance = distance_scan_to_map(map, scan, currentpos);
+    search_cache_t cache;
+    position_t levelpos = start_pos;
+    map_t * grid = level_map(map, &levelpos, level);
+    
+    int current_distance = rotation_search_distance(rotations, grid, level, levelpos, sigma_theta_degrees, INT_MAX);
+    
+    int cache_scores = options & RMHC_SEARCH_CACHE_SCORES;
+    search_cache_entry_t * entry = NULL;
+    
+    if (cache_scores)
+    {
+        search_cache_init(&cache, grid, scan);
+        
+        entry = search_cache_find(&cache, levelpos);
+        entry->distance = current_distance;
+        entry->valid = 1;
+    }
     
     int lowest_distance =  current_distance;
     int last_lowest_distance = current_distance;
@@ -611,17 +2610,49 @@ position_t
         currentpos.y_mm = random_normal(randomizer, currentpos.y_mm, sigma_xy_mm);
         currentpos.theta_degrees = random_normal(randomizer, currentpos.theta_degrees, sigma_theta_degrees);
         
-        current_distance = distance_scan_to_map(map, scan, currentpos);
+        levelpos = currentpos;
+        level_map(map, &levelpos, level);
+        
+        COUNT_SEARCH(iterations, 1);
+        
+        entry = cache_scores ? search_cache_find(&cache, levelpos) : NULL;
+        
+        /* A bin scored earlier cannot beat the lowest distance, which only falls */
+        if (entry && entry->valid)
+        {
+            current_distance = entry->distance;
+            
+            COUNT_SEARCH(cache_hits, 1);
+        }
+        
+        /* Scoring stops early once the candidate cannot beat the lowest distance */
+        else
+        {
+            current_distance = 
+                rotation_search_distance(rotations, grid, level, levelpos, sigma_theta_degrees, lowest_distance);
+            
+            if (entry)
+            {
+                entry->distance = current_distance;
+                entry->valid = 1;
+            }
+            
+            COUNT_SEARCH(points, scan->obst_npoints);
+        }
         
         /* -1 indicates infinity */
         if ((current_distance > -1) && (current_distance < lowest_distance))
         {
             lowest_distance = current_distance;
             bestpos = currentpos;
+            
+            COUNT_SEARCH(accepted, 1);
         }
         else
         {
             counter++;
+            
+            COUNT_SEARCH(rejected, 1);
         }
         
         if (counter > max_search_iter / 3)
@@ -640,3 +2671,177 @@ position_t
     
     return bestpos;
 }
+
+position_t
+        rmhc_position_search(
+        position_t start_pos,
+        map_t * map,
+        scan_t * scan,
+        double sigma_xy_mm,
+        double sigma_theta_degrees,
+        int max_search_iter,
+        void * randomizer)
+{
+    return rmhc_position_search_ex(start_pos, map, scan, sigma_xy_mm, sigma_theta_degrees, max_search_iter, randomizer,
+                                   RMHC_SEARCH_EXACT);
+}
+
+position_t
+        rmhc_position_search_ex(
+        position_t start_pos,
+        map_t * map,
+        scan_t * scan,
+        double sigma_xy_mm,
+        double sigma_theta_degrees,
+        int max_search_iter,
+        void * randomizer,
+        int options)
+{
+    rotation_search_t rotations;
+    rotation_search_init(&rotations, map, scan, options);
+    
+    position_t pos = rmhc_search_level(start_pos, map, 0, scan, sigma_xy_mm, sigma_theta_degrees, max_search_iter, 
+                                       randomizer, options, &rotations);
+    
+    rotation_search_free(&rotations);
+    
+    return pos;
+}
+
+position_t
+        rmhc_position_search_coarse_to_fine(
+        position_t start_pos,
+        map_t * map,
+        scan_t * scan,
+        double sigma_xy_mm,
+        double sigma_theta_degrees,
+        int max_search_iter,
+        void * randomizer,
+        int options)
+{
+    int level_search_iter = max_search_iter / (map->pyramid_levels + 1);
+    
+    /* All levels score from the same rotated points */
+    rotation_search_t rotations;
+    rotation_search_init(&rotations, map, scan, options);
+    
+    position_t pos = start_pos;
+    
+    int level = 0;
+    for (level=map->pyramid_levels; level>0; --level)
+    {
+        pos = rmhc_search_level(pos, map, level, scan, sigma_xy_mm, sigma_theta_degrees, level_search_iter, randomizer,
+                                options, &rotations);
+        
+        sigma_xy_mm *= 0.5;
+        sigma_theta_degrees *= 0.5;
+    }
+    
+    /* Full resolution gets any leftover iterations */
+    pos = rmhc_search_level(pos, map, 0, scan, sigma_xy_mm, sigma_theta_degrees, 
+                            max_search_iter - map->pyramid_levels * level_search_iter, randomizer, options, &rotations);
+    
+    rotation_search_free(&rotations);
+    
+    return pos;
+}
+
+position_t
+        bnb_position_search(
+        position_t start_pos,
+        map_t * map,
+        scan_t * scan,
+        double window_xy_mm,
+        double window_theta_degrees,
+        double theta_step_degrees)
+{
+    bnb_search_t search;
+    
+    int nrotations_each_way = theta_step_degrees > 0 ? (int)(window_theta_degrees / theta_step_degrees) : 0;
+    int nrotations = 2 * nrotations_each_way + 1;
+    
+    search.map = map;
+    search.window_pixels = (int)(window_xy_mm * map->scale_pixels_per_mm);
+    search.npoints = scan->obst_npoints;
+    search.base_x = int_alloc(nrotations * scan->obst_npoints + 1);
+    search.base_y = int_alloc(nrotations * scan->obst_npoints + 1);
+    
+    /* Pre-compute pixel offset for translation */
+    double pos_x_pix = start_pos.x_mm * map->scale_pixels_per_mm;
+    double pos_y_pix = start_pos.y_mm * map->scale_pixels_per_mm;
+    
+    /* Rotate scan once per rotation; translations are then whole-pixel offsets */
+    int r = 0;
+    for (r=0; r<nrotations; ++r)
+    {
+        double theta_degrees = start_pos.theta_degrees + (r - nrotations_each_way) * theta_step_degrees;
+        double position_theta_radians = radians(theta_degrees);
+        double costheta = cos(position_theta_radians) * map->scale_pixels_per_mm;
+        double sintheta = sin(position_theta_radians) * map->scale_pixels_per_mm;
+        
+        int i = 0;
+        for (i=0; i<scan->obst_npoints; ++i)
+        {
+            double x = scan->obst_x_mm[i];
+            double y = scan->obst_y_mm[i];
+            
+            search.base_x[r*scan->obst_npoints+i] = (int)floor(pos_x_pix + costheta * x - sintheta * y + 0.5);
+            search.base_y[r*scan->obst_npoints+i] = (int)floor(pos_y_pix + sintheta * x + costheta * y + 0.5);
+        }
+    }
+    
+    /* Start with the starting position as the best so far, to prune early */
+    search.best_rotation = nrotations_each_way;
+    search.best_dx = 0;
+    search.best_dy = 0;
+    search.best_distance = bnb_bound(&search, 0, nrotations_each_way, 0, 0);
+    if (search.best_distance < 0)
+    {
+        search.best_distance = INT_MAX;
+    }
+    
+    /* Cover the window with blocks at the coarsest pyramid level */
+    int level = map->pyramid_levels;
+    int width = 1 << level;
+    int nblocks = (2 * search.window_pixels) / width + 1;
+    
+    bnb_candidate_t * candidates = 
+        (bnb_candidate_t *)safe_malloc(nrotations * nblocks * nblocks * sizeof(bnb_candidate_t));
+    int ncandidates = 0;
+    
+    for (r=0; r<nrotations; ++r)
+    {
+        int j = 0;
+        for (j=0; j<nblocks; ++j)
+        {
+            int k = 0;
+            for (k=0; k<nblocks; ++k)
+            {
+                bnb_candidate_t * candidate = &candidates[ncandidates++];
+                candidate->rotation = r;
+                candidate->dx = -search.window_pixels + k * width;
+                candidate->dy = -search.window_pixels + j * width;
+                candidate->bound = bnb_bound(&search, level, r, candidate->dx, candidate->dy);
+            }
+        }
+    }
+    
+    qsort(candidates, ncandidates, sizeof(bnb_candidate_t), bnb_compar);
+    
+    int k = 0;
+    for (k=0; k<ncandidates; ++k)
+    {
+        bnb_branch(&search, level, candidates[k]);
+    }
+    
+    free(candidates);
+    free(search.base_x);
+    free(search.base_y);
+    
+    position_t bestpos = start_pos;
+    bestpos.x_mm += search.best_dx / map->scale_pixels_per_mm;
+    bestpos.y_mm += search.best_dy / map->scale_pixels_per_mm;
+    bestpos.theta_degrees += (search.best_rotation - nrotations_each_way) * theta_step_degrees;
+    
+    return bestpos;
+}
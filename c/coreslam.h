@@ -19,6 +19,8 @@ You should have received a copy of the GNU Lesser General Public License
 along with this code.  If not, see <http:#www.gnu.org/licenses/>.
 */
 
+#include <stddef.h>
+
 /* Default parameters --------------------------------------------------------*/
 
 static const int    DEFAULT_MAP_QUALITY         = 50; /* out of 255 */
@@ -29,6 +31,25 @@ static const double DEFAULT_SIGMA_THETA_DEGREES = 20;
 
 static const double DEFAULT_MAX_SEARCH_ITER     = 1000;
 
+static const double DEFAULT_WINDOW_XY_MM         = 200;
+static const double DEFAULT_WINDOW_THETA_DEGREES = 10;
+static const double DEFAULT_THETA_STEP_DEGREES   = 1;
+static const int    DEFAULT_BOUND_LEVELS         = 2;
+
+/* Width and height of the square tiles whose changes are tracked for map_get_tiles */
+static const int    MAP_TILE_SIZE_PIXELS         = 64;
+
+/* Options for rmhc_position_search_ex, which may be combined with |.  Each makes the search faster
+   by treating nearby candidates alike, so that it finds slightly different positions. */
+static const int    RMHC_SEARCH_EXACT            = 0; /* score each candidate at its own position */
+static const int    RMHC_SEARCH_CACHE_SCORES     = 1; /* score each pixel and small angle bin once */
+static const int    RMHC_SEARCH_ROTATED_BINS     = 2; /* score at the center of each small angle bin */
+
+/* Ways for map_open to give a map the pixels of a file */
+static const int    MAP_OPEN_COPY                = 0; /* read into memory */
+static const int    MAP_OPEN_READ_ONLY           = 1; /* map the file, shared; the map cannot change */
+static const int    MAP_OPEN_COPY_ON_WRITE       = 2; /* map the file, copying pages as they change */
+
 
 /* Core types --------------------------------------------------------------- */
 
@@ -40,7 +61,13 @@ typedef struct position_t
     
 } position_t;
 
+/* Map pixels hold 16-bit values, or the top 8 bits of them if built with -DBREEZYSLAM_MAP8,
+   which halves the memory and bandwidth of the map */
+#ifdef BREEZYSLAM_MAP8
+typedef unsigned char pixel_t;
+#else
 typedef unsigned short pixel_t;
+#endif
 
 typedef struct map_t {
     
@@ -50,6 +77,33 @@ typedef struct map_t {
     
     double scale_pixels_per_mm;
     
+    /* optional pyramid of min-pooled maps at 1/2, 1/4, ... resolution */
+    struct map_t * pyramid;
+    int pyramid_levels;
+    
+    /* bumped by each map_update and map_set */
+    unsigned version;
+    
+    /* version of the last change to each tile, row by row (size_tiles^2) */
+    unsigned * tile_versions;
+    int size_tiles;
+    
+    /* for sparse maps (see map_init_sparse), pixels is NULL and the map is stored as a 
+       directory of size_tiles^2 tiles, row by row, each holding its pixels row by row; 
+       tiles never written all point to unknown_tile */
+    pixel_t ** tiles;
+    pixel_t * unknown_tile;
+    int ntiles_allocated;
+    
+    /* position of pixel (0,0) in the world, saved with the map but not used by BreezySLAM */
+    double origin_x_mm;
+    double origin_y_mm;
+    
+    /* for maps opened from a file by mapping it into memory */
+    void * mapping;
+    size_t mapping_bytes;
+    int read_only;
+    
 } map_t;
 
 
@@ -70,14 +124,39 @@ typedef struct scan_t
 
     /* for angle/distance interpolation */
     void * interpolation;
+
+    /* cosine and sine of the angle of each point (size*span), computed by scan_init */
+    double * cos_angle;
+    double * sin_angle;
+
+    /* cosine and sine of the velocity-dependent change to each angle, for the current scan */
+    double * cos_correction;
+    double * sin_correction;
      
     /* for SSE */
     float * obst_x_mm;
     float * obst_y_mm;
+    float * obst_scratch_x_mm;          /* the same size, swapped with obst_x_mm when stratifying */
+    float * obst_scratch_y_mm;
     int obst_npoints;
+    double obst_reach_mm;               /* distance of the farthest obstacle point from the laser */
+    
+    /* obstacle points rotated by RMHC_SEARCH_ROTATED_BINS searches, shared by all searches of a scan */
+    void * rotations;
         
 } scan_t;
 
+/* Work done by position searches, counted only when built with -DBREEZYSLAM_STATS */
+typedef struct search_stats_t
+{
+    long iterations;    /* candidate positions tried */
+    long accepted;      /* candidates that beat the best so far */
+    long rejected;      /* candidates that did not */
+    long points;        /* scan points given to the scorer, which may stop early */
+    long cache_hits;    /* candidates whose pixel and angle bin was already scored */
+    
+} search_stats_t;
+
 /* Exported functions ------------------------------------------------------- */
 
 #ifdef __cplusplus 
@@ -99,10 +178,48 @@ map_init(
     int size_pixels, 
     double size_meters);
 
+/* Like map_init, but allocates each MAP_TILE_SIZE_PIXELS square tile of the map only when it 
+   is first written, so that memory grows with the area explored rather than the size of the 
+   map.  Scoring a sparse map always uses the sisd kernel. */
+void 
+map_init_sparse(
+    map_t * map, 
+    int size_pixels, 
+    double size_meters);
+
 void
 map_free(
     map_t * map);
 
+/* Saves a map to a file: a header giving the format version, byte order, size in pixels and 
+   meters, pixel size, and origin, followed by the pixels at a page boundary, so that map_open 
+   can map them straight into memory.  Fields and pixels are stored in the byte order of this
+   machine.  Returns 0 on success, -1 on failure (see errno). */
+int
+map_save(
+    map_t * map,
+    const char * filename);
+
+/* Initializes a map from a file saved by map_save, in one of the MAP_OPEN_ modes.  The mapping 
+   modes take no time to load, and processes mapping the same file share one copy of the pixels
+   they have not changed; the map_update functions and map_set do nothing to a read-only map 
+   but report the attempt.  The byte order and pixel size of the file must match this build.  
+   Returns 0 on success, -1 on failure (including an unknown mode). */
+int
+map_open(
+    map_t * map,
+    const char * filename,
+    int mode);
+
+/* Builds a pyramid of nlevels maps at 1/2, 1/4, ... the resolution of this map, 
+   kept up to date by map_update and map_set.  Each pixel holds the minimum of the 
+   pixels it covers, so that scoring against a level gives a lower bound on the 
+   distance at full resolution.  Zero levels removes the pyramid. */
+void
+map_init_pyramid(
+    map_t * map,
+    int nlevels);
+
 void map_string(
     map_t map,
     char * str);
@@ -115,6 +232,42 @@ map_update(
     int map_quality, 
     double hole_width_mm);
 
+/* Does the work of map_update, except the pyramid and changed tiles, for the pixels on rings [ring_start, ring_end)
+   around the position, where ring r holds the pixels r steps away in x or y (and no more in the
+   other).  Calls on disjoint ring ranges touch disjoint pixels, so they can run in parallel;
+   calls covering every ring give exactly the map that map_update would. */
+void
+map_update_rings(
+    map_t * map,
+    scan_t * scan,
+    position_t position,
+    int map_quality,
+    double hole_width_mm,
+    int ring_start,
+    int ring_end);
+
+/* Splits the rings for map_update_rings into nparts ranges with about the same number of
+   pixel updates each: part k is [bounds[k], bounds[k+1]), with bounds holding nparts+1 values.
+   For sparse maps, also allocates the tiles the scan will write, so it must be called before
+   map_update_rings. */
+void
+map_update_ring_bounds(
+    map_t * map,
+    scan_t * scan,
+    position_t position,
+    double hole_width_mm,
+    int nparts,
+    int * bounds);
+
+/* Finishes the update after map_update_rings, as map_update would have: brings the pyramid
+   up to date and marks the changed tiles */
+void
+map_update_finish(
+    map_t * map,
+    scan_t * scan,
+    position_t position,
+    double hole_width_mm);
+
 void scan_init(
     scan_t * scan, 
     int span,
@@ -133,6 +286,8 @@ void scan_string(
     scan_t scan,
     char * str);
 
+/* If lidar_angles_deg is not NULL, the scan_size distances are first resampled to one per 
+   degree by linear interpolation over their angles; lidar_distances_mm is left unchanged. */
 void 
 scan_update(
     scan_t * scan, 
@@ -143,6 +298,20 @@ scan_update(
     double velocities_dxy_mm,
     double velocities_dtheta_degrees);
 
+/* Updates several scans (e.g. with different spans) of the same laser from one set of 
+   lidar values, in a single pass that filters, interpolates, and compensates for 
+   velocity once for all of them.  Same parameters as scan_update otherwise. */
+void 
+scan_update_multiple(
+    scan_t ** scans,
+    int nscans,
+    float * lidar_angles_deg,
+    int   * lidar_distances_mm, 
+    int     scan_size, 
+    double hole_width_mm,
+    double velocities_dxy_mm,
+    double velocities_dtheta_degrees);
+
 void
 map_get(
     map_t * map, 
@@ -152,6 +321,18 @@ void
 map_set(
     map_t * map, 
     char * bytes);
+
+/* Gets the tiles changed since the map had version since_version, as map_get would: tile 
+   indices (row by row, map->size_tiles per row) go into tiles, and the pixels of each tile, 
+   MAP_TILE_SIZE_PIXELS^2 bytes row by row, into bytes, padded with zeros beyond the map.  
+   Both arrays must hold map->size_tiles^2 tiles.  Returns the number of tiles.  Version 0 
+   gets every tile; map->version is the version to pass next time. */
+int
+map_get_tiles(
+    map_t * map,
+    unsigned since_version,
+    int * tiles,
+    char * bytes);
     
 /* Returns -1 for infinity */
 int 
@@ -160,8 +341,57 @@ distance_scan_to_map(
     scan_t * scan,
     position_t position);
 
+/* Computes distance_scan_to_map for each of npositions positions, storing the results
+   in distances.  Faster than calling distance_scan_to_map once per position, because 
+   each pass over the scan scores several positions. */
+void
+distance_scan_to_map_batch(
+    map_t *  map,
+    scan_t * scan,
+    position_t * positions,
+    int npositions,
+    int * distances);
+
+/* Returns distance_scan_to_map if it is less than bound; otherwise may stop scoring as soon
+   as the partial sum shows the distance cannot be less than bound, and return bound. 
+   Obstacle points are visited in an order that samples the whole scan early. */
+int 
+distance_scan_to_map_bounded(
+    map_t *  map,
+    scan_t * scan,
+    position_t position,
+    int bound);
+
+/* Forces distance_scan_to_map to use the named kernel ("sisd", "sse", "avx2", "avx512", "neon"), 
+   e.g. for benchmarking.  The default is the fastest kernel supported by the CPU, or the value
+   of the BREEZYSLAM_KERNEL environment variable.  Returns 0 on success, -1 if the kernel is not
+   available on this machine. */
+int
+distance_scan_to_map_select(
+    const char * kernel_name);
+
+/* Returns the name of the kernel used by distance_scan_to_map */
+const char *
+distance_scan_to_map_kernel(void);
 
-/* Random-Mutation Hill-Climbing search */
+
+/* Returns distance_scan_to_map against pyramid level (1 = half resolution, etc.; 
+   0 = the map itself), using the coarse pixel containing each full-resolution pixel */
+int 
+distance_scan_to_map_level(
+    map_t *  map,
+    scan_t * scan,
+    position_t position,
+    int level);
+
+/* Gets the work done by rmhc_position_search and rmhc_position_search_coarse_to_fine on the 
+   calling thread since the last call, and starts counting again.  Returns 0, or -1 (with all 
+   counts zero) if not built with BREEZYSLAM_STATS. */
+int
+search_stats_take(
+    search_stats_t * stats);
+
+/* Random-Mutation Hill-Climbing search, scoring each candidate at its own position */
 position_t 
 rmhc_position_search(
     position_t start_pos,
@@ -172,6 +402,54 @@ rmhc_position_search(
 	int max_search_iter,
 	void * randomizer);
 
+/* Random-Mutation Hill-Climbing search, with RMHC_SEARCH_ options.  With 
+   RMHC_SEARCH_CACHE_SCORES, a candidate that rounds to a map pixel and angle bin already scored
+   at the same search level gets the earlier score; the bins are small enough that no obstacle 
+   point moves more than half a pixel within one.  With RMHC_SEARCH_ROTATED_BINS, once the angle 
+   sigma is small, candidates are scored at the center of their angle bin, from obstacle points 
+   that the scan keeps rotated to each bin until its next update, for all searches and levels; 
+   this pays most with kernels that lack gathers (sisd, sse, neon).  Searches of one scan may 
+   run in parallel. */
+position_t 
+rmhc_position_search_ex(
+    position_t start_pos,
+	map_t * map,
+    scan_t * scan,
+	double sigma_xy_mm,
+	double sigma_theta_degrees,
+	int max_search_iter,
+	void * randomizer,
+	int options);
+
+/* Random-Mutation Hill-Climbing search from the coarsest pyramid level to full 
+   resolution, halving the sigmas at each finer level.  The iterations are split 
+   evenly among the levels. */
+position_t 
+rmhc_position_search_coarse_to_fine(
+    position_t start_pos,
+	map_t * map,
+    scan_t * scan,
+	double sigma_xy_mm,
+	double sigma_theta_degrees,
+	int max_search_iter,
+	void * randomizer,
+	int options);
+
+/* Branch-and-bound search for the position with the lowest distance_scan_to_map 
+   among all whole-pixel translations within +/- window_xy_mm of the starting position, 
+   at rotations within +/- window_theta_degrees in steps of theta_step_degrees.  
+   Blocks of candidates are pruned using bounds from the map pyramid 
+   (see map_init_pyramid), so the search is exhaustive but its worst-case cost is 
+   fixed by the window. */
+position_t 
+bnb_position_search(
+    position_t start_pos,
+    map_t * map,
+    scan_t * scan,
+    double window_xy_mm,
+    double window_theta_degrees,
+    double theta_step_degrees);
+
 #ifdef __cplusplus 
 }
 #endif
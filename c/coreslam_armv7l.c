@@ -27,11 +27,13 @@ typedef __int64 int64_t;       /* Define it from MSVC's internal type */
 #include <math.h>
 #include <stdio.h>
 
-#include <arm_neon.h>
-
 #include "coreslam.h"
 #include "coreslam_internals.h"
 
+#ifdef CORESLAM_NEON
+
+#include <arm_neon.h>
+
 /* Performs one rotation/translation */
 static void 
 neon_coord_4(
@@ -54,7 +56,7 @@ neon_coord_4(
 
 
 int
-distance_scan_to_map(
+distance_scan_to_map_neon(
 		map_t *  map,
 		scan_t * scan,
 		position_t position)
@@ -68,6 +70,8 @@ distance_scan_to_map(
     double pos_x_pix = position.x_mm * map->scale_pixels_per_mm;
     double pos_y_pix = position.y_mm * map->scale_pixels_per_mm;
 
+    /* Test points against the map bounds only if some can fall outside */
+    int in_map = scan_in_map(map, scan, pos_x_pix, pos_y_pix);
 
     float32x4_t half_4  = vdupq_n_f32(0.5);
 
@@ -105,7 +109,7 @@ distance_scan_to_map(
             int y = yarr[j];
 
 	    /* Add point if in map bounds */
-	    if (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels) 
+	    if (in_map || (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels)) 
 	    {
 		    sum += map->pixels[y * map->size_pixels + x];
 		    npoints++;
@@ -115,3 +119,5 @@ distance_scan_to_map(
 
     return npoints ? (int)(sum * 1024 / npoints) : -1;  
 }
+
+#endif
@@ -41,6 +41,8 @@ typedef __int64 int64_t;       /* Define it from MSVC's internal type */
 #include "coreslam.h"
 #include "coreslam_internals.h"
 
+#ifdef CORESLAM_X86
+
 #include <pmmintrin.h>
 #include <xmmintrin.h>
 #include <mmintrin.h>
@@ -60,8 +62,9 @@ typedef union
 } cs_pos_mmx_t;
 
 
+KERNEL_TARGET("sse3")
 int 
-distance_scan_to_map(
+distance_scan_to_map_sse(
     map_t *  map,
     scan_t * scan,
     position_t position)
@@ -78,6 +81,9 @@ distance_scan_to_map(
     double pos_x_pix = position.x_mm * map->scale_pixels_per_mm;
     double pos_y_pix = position.y_mm * map->scale_pixels_per_mm;
     
+    /* Test points against the map bounds only if some can fall outside */
+    int in_map = scan_in_map(map, scan, pos_x_pix, pos_y_pix);
+    
     __m128 sincos128 = _mm_set_ps (costheta, -sintheta, sintheta, costheta);
     __m128 posxy128  = _mm_set_ps (pos_x_pix, pos_y_pix, pos_x_pix, pos_y_pix);
 
@@ -103,7 +109,7 @@ distance_scan_to_map(
             _mm_empty();
          
             /* Add point if in map bounds */
-            if (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels) 
+            if (in_map || (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels)) 
             {
                 sum += map->pixels[y * map->size_pixels + x];
                 npoints++;
@@ -115,3 +121,4 @@ distance_scan_to_map(
     return npoints ? (int)(sum * 1024 / npoints) : -1;  
 }
 
+#endif
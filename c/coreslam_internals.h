@@ -27,10 +27,112 @@ typedef __int64 int64_t;       /* Define it from MSVC's internal type */
 #endif
 
 
+/* Architectures whose SIMD kernels are compiled into the library */
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define CORESLAM_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CORESLAM_NEON
+#endif
+
 static const int NO_OBSTACLE            = 65500;
 static const int OBSTACLE               = 0;
 
-static double 
+/* Bits dropped from 16-bit map values to store them in pixel_t.  Blending 8-bit pixels 
+   rounds to nearest, so that they do not creep down by truncation. */
+#ifdef BREEZYSLAM_MAP8
+#define PIXEL_SHIFT     8
+#define PIXEL_ROUNDING  128
+#define PIXEL_MASK      0xFF
+#else
+#define PIXEL_SHIFT     0
+#define PIXEL_ROUNDING  0
+#define PIXEL_MASK      0xFFFF
+#endif
+
+/* Scan-to-map distance kernels, selected at run time by distance_scan_to_map(), 
+   distance_scan_to_map_batch(), and distance_scan_to_map_bounded().  The rotated kernels 
+   score obstacle points already rotated into full-resolution pixels with ROTATED_FRACTION_BITS 
+   fractional bits, translated by pos_x, pos_y in the same units (including one half of a 
+   map pixel for rounding) and shifted right by shift bits, which is ROTATED_FRACTION_BITS 
+   plus the pyramid level of the map.  They stop early like the bounded kernels, and test 
+   points against the map bounds only if in_map is zero. */
+#define ROTATED_FRACTION_BITS 8
+
+int distance_scan_to_map_sisd(map_t * map, scan_t * scan, position_t position);
+int distance_scan_to_map_bounded_sisd(map_t * map, scan_t * scan, position_t position, int bound);
+void distance_scan_to_map_batch_sisd(map_t * map, scan_t * scan, 
+                                     position_t * positions, int npositions, int * distances);
+int distance_rotated_scan_to_map_sisd(map_t * map, int * rotated_x, int * rotated_y, int npoints, 
+                                      int pos_x, int pos_y, int shift, int bound, int in_map);
+
+#ifdef CORESLAM_X86
+int distance_scan_to_map_sse(map_t * map, scan_t * scan, position_t position);
+int distance_scan_to_map_avx2(map_t * map, scan_t * scan, position_t position);
+int distance_scan_to_map_avx512(map_t * map, scan_t * scan, position_t position);
+int distance_scan_to_map_bounded_avx2(map_t * map, scan_t * scan, position_t position, int bound);
+int distance_scan_to_map_bounded_avx512(map_t * map, scan_t * scan, position_t position, int bound);
+void distance_scan_to_map_batch_avx2(map_t * map, scan_t * scan, 
+                                     position_t * positions, int npositions, int * distances);
+void distance_scan_to_map_batch_avx512(map_t * map, scan_t * scan, 
+                                       position_t * positions, int npositions, int * distances);
+int distance_rotated_scan_to_map_avx2(map_t * map, int * rotated_x, int * rotated_y, int npoints, 
+                                      int pos_x, int pos_y, int shift, int bound, int in_map);
+int distance_rotated_scan_to_map_avx512(map_t * map, int * rotated_x, int * rotated_y, int npoints, 
+                                        int pos_x, int pos_y, int shift, int bound, int in_map);
+#endif
+
+#ifdef CORESLAM_NEON
+int distance_scan_to_map_neon(map_t * map, scan_t * scan, position_t position);
+#endif
+
+/* Bounded kernels test the running sum against the bound after this many points */
+#define BOUND_CHECK_POINTS 64
+
+/* Map values are non-negative and at most npoints points can be in the map, so once the 
+   partial sum reaches bound * npoints / 1024 the distance cannot be less than bound */
+static inline int 
+bound_reached(int64_t partial_sum, int bound, int npoints)
+{
+    return partial_sum * 1024 >= (int64_t)bound * npoints;
+}
+
+/* Returns the pixel at (x, y), which must be in the map, for dense or sparse maps */
+static inline pixel_t
+map_pixel(map_t * map, int x, int y)
+{
+    if (map->tiles)
+    {
+        unsigned ux = x, uy = y;
+        pixel_t * tile = map->tiles[(uy / MAP_TILE_SIZE_PIXELS) * map->size_tiles + ux / MAP_TILE_SIZE_PIXELS];
+        
+        return tile[(uy % MAP_TILE_SIZE_PIXELS) * MAP_TILE_SIZE_PIXELS + ux % MAP_TILE_SIZE_PIXELS];
+    }
+    
+    return map->pixels[y * map->size_pixels + x];
+}
+
+/* Returns nonzero if every obstacle point of a scan lands in the map when translated by 
+   (pos_x_pix, pos_y_pix) pixels and rotated by any angle, so that a kernel can skip testing 
+   each point against the map bounds.  The extra pixel covers rounding. */
+static inline int
+scan_in_map(map_t * map, scan_t * scan, double pos_x_pix, double pos_y_pix)
+{
+    double reach_pixels = scan->obst_reach_mm * map->scale_pixels_per_mm + 1;
+    
+    return pos_x_pix >= reach_pixels && pos_x_pix + reach_pixels < map->size_pixels &&
+           pos_y_pix >= reach_pixels && pos_y_pix + reach_pixels < map->size_pixels;
+}
+
+/* Lets GCC compile a kernel for an instruction set not enabled on the command line */
+#ifdef __GNUC__
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+static inline double 
 radians(double degrees)
 {
     return degrees * M_PI / 180;
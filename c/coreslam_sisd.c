@@ -29,7 +29,7 @@ along with this code.  If not, see <http:#www.gnu.org/licenses/>.
 #include "coreslam_internals.h"
 
 int 
-distance_scan_to_map(
+distance_scan_to_map_sisd(
     map_t *  map,
     scan_t * scan,
     position_t position)
@@ -42,9 +42,60 @@ distance_scan_to_map(
     /* Pre-compute pixel offset for translation */
     double pos_x_pix = position.x_mm * map->scale_pixels_per_mm;
     double pos_y_pix = position.y_mm * map->scale_pixels_per_mm;
+    
+    /* Test points against the map bounds only if some can fall outside */
+    int in_map = scan_in_map(map, scan, pos_x_pix, pos_y_pix);
+
+    int64_t sum = 0; /* sum of map values at those points */
+    int npoints = 0; /* number of points where scan matches map */
+    
+    int i = 0;
+    for (i=0; i<scan->npoints; i++) 
+    {        
+        /* Consider only scan points representing obstacles */
+        if (scan->value[i] == OBSTACLE)
+        {
+            /* Translate and rotate scan point to robot position */
+            int x = floor(pos_x_pix + costheta * scan->x_mm[i] - sintheta * scan->y_mm[i] + 0.5);
+            int y = floor(pos_y_pix + sintheta * scan->x_mm[i] + costheta * scan->y_mm[i] + 0.5);
+         
+            /* Add point if in map bounds */
+            if (in_map || (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels)) 
+            {
+                sum += map_pixel(map, x, y);
+                npoints++;
+            } 
+        }
+    } 
+
+    /* Return sum scaled by number of points, or -1 if none */
+    return npoints ? (int)(sum * 1024 / npoints) : -1;  
+}
+
+/* Same arithmetic and point order as distance_scan_to_map_sisd, so whenever the distance 
+   is below the bound the result is identical */
+int 
+distance_scan_to_map_bounded_sisd(
+    map_t *  map,
+    scan_t * scan,
+    position_t position,
+    int bound)
+{    
+    /* Pre-compute sine and cosine of angle for rotation */
+    double position_theta_radians = radians(position.theta_degrees);
+    double costheta = cos(position_theta_radians) * map->scale_pixels_per_mm;
+    double sintheta = sin(position_theta_radians) * map->scale_pixels_per_mm;
+    
+    /* Pre-compute pixel offset for translation */
+    double pos_x_pix = position.x_mm * map->scale_pixels_per_mm;
+    double pos_y_pix = position.y_mm * map->scale_pixels_per_mm;
+    
+    /* Test points against the map bounds only if some can fall outside */
+    int in_map = scan_in_map(map, scan, pos_x_pix, pos_y_pix);
 
     int64_t sum = 0; /* sum of map values at those points */
     int npoints = 0; /* number of points where scan matches map */
+    int nobstacles = 0;
     
     int i = 0;
     for (i=0; i<scan->npoints; i++) 
@@ -57,11 +108,125 @@ distance_scan_to_map(
             int y = floor(pos_y_pix + sintheta * scan->x_mm[i] + costheta * scan->y_mm[i] + 0.5);
          
             /* Add point if in map bounds */
-            if (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels) 
+            if (in_map || (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels)) 
             {
-                sum += map->pixels[y * map->size_pixels + x];
+                sum += map_pixel(map, x, y);
                 npoints++;
             } 
+            
+            /* Give up once this position cannot beat the bound */
+            if (++nobstacles % BOUND_CHECK_POINTS == 0 && bound_reached(sum, bound, scan->obst_npoints))
+            {
+                return bound;
+            }
+        }
+    } 
+
+    /* Return sum scaled by number of points, or -1 if none */
+    return npoints ? (int)(sum * 1024 / npoints) : -1;  
+}
+
+/* Positions scored together per pass over the scan */
+#define BATCH_POSITIONS 8
+
+void
+distance_scan_to_map_batch_sisd(
+    map_t *  map,
+    scan_t * scan,
+    position_t * positions,
+    int npositions,
+    int * distances)
+{    
+    double costheta[BATCH_POSITIONS];
+    double sintheta[BATCH_POSITIONS];
+    double pos_x_pix[BATCH_POSITIONS];
+    double pos_y_pix[BATCH_POSITIONS];
+    int in_map[BATCH_POSITIONS];
+    int64_t sum[BATCH_POSITIONS];
+    int npoints[BATCH_POSITIONS];
+    
+    int p = 0;
+    for (p=0; p<npositions; p+=BATCH_POSITIONS)
+    {
+        int nbatch = npositions - p < BATCH_POSITIONS ? npositions - p : BATCH_POSITIONS;
+        
+        /* Pre-compute sine, cosine, and pixel offset for each position */
+        int k = 0;
+        for (k=0; k<nbatch; ++k)
+        {
+            double position_theta_radians = radians(positions[p+k].theta_degrees);
+            costheta[k] = cos(position_theta_radians) * map->scale_pixels_per_mm;
+            sintheta[k] = sin(position_theta_radians) * map->scale_pixels_per_mm;
+            pos_x_pix[k] = positions[p+k].x_mm * map->scale_pixels_per_mm;
+            pos_y_pix[k] = positions[p+k].y_mm * map->scale_pixels_per_mm;
+            in_map[k] = scan_in_map(map, scan, pos_x_pix[k], pos_y_pix[k]);
+            sum[k] = 0;
+            npoints[k] = 0;
+        }
+        
+        /* Load each obstacle point once for the whole batch */
+        int i = 0;
+        for (i=0; i<scan->npoints; i++) 
+        {        
+            if (scan->value[i] == OBSTACLE)
+            {
+                double scan_x = scan->x_mm[i];
+                double scan_y = scan->y_mm[i];
+                
+                for (k=0; k<nbatch; ++k)
+                {
+                    int x = floor(pos_x_pix[k] + costheta[k] * scan_x - sintheta[k] * scan_y + 0.5);
+                    int y = floor(pos_y_pix[k] + sintheta[k] * scan_x + costheta[k] * scan_y + 0.5);
+                    
+                    if (in_map[k] || (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels)) 
+                    {
+                        sum[k] += map_pixel(map, x, y);
+                        npoints[k]++;
+                    } 
+                }
+            }
+        }
+        
+        for (k=0; k<nbatch; ++k)
+        {
+            distances[p+k] = npoints[k] ? (int)(sum[k] * 1024 / npoints[k]) : -1;  
+        }
+    }
+}
+
+int 
+distance_rotated_scan_to_map_sisd(
+    map_t *  map,
+    int * rotated_x,
+    int * rotated_y,
+    int npoints_rotated,
+    int pos_x,
+    int pos_y,
+    int shift,
+    int bound,
+    int in_map)
+{    
+    int64_t sum = 0; /* sum of map values at those points */
+    int npoints = 0; /* number of points where scan matches map */
+    
+    int i = 0;
+    for (i=0; i<npoints_rotated; i++) 
+    {        
+        /* Translate rotated scan point to robot position, rounding down */
+        int x = (pos_x + rotated_x[i]) >> shift;
+        int y = (pos_y + rotated_y[i]) >> shift;
+     
+        /* Add point if in map bounds */
+        if (in_map || (x >= 0 && x < map->size_pixels && y >= 0 && y < map->size_pixels)) 
+        {
+            sum += map_pixel(map, x, y);
+            npoints++;
+        } 
+        
+        /* Give up once this position cannot beat the bound */
+        if ((i + 1) % BOUND_CHECK_POINTS == 0 && bound_reached(sum, bound, npoints_rotated))
+        {
+            return bound;
         }
     } 
 
@@ -0,0 +1,590 @@
+/*
+coreslam_x86_64.c Intel Advanced Vector Extensions (AVX2 / AVX-512) for CoreSLAM
+
+Processes 8 (AVX2) or 16 (AVX-512) obstacle points per iteration from the
+structure-of-arrays obst_x_mm / obst_y_mm, using vector rounding, masked bounds
+checks, and gathers from the map.  Coordinates are computed in single precision,
+as in the SSE and NEON kernels.  Both kernels are compiled on all Intel platforms;
+distance_scan_to_map() picks the one the CPU supports at run time.  The batch
+kernels score several positions per pass over the scan, so each block of points
+is loaded once for all of them.  The bounded kernels stop as soon as the partial
+sum shows that a position cannot beat the bound.  The rotated kernels take points
+already rotated into fixed-point pixels, leaving an integer add and shift per
+coordinate before the gather.
+
+Copyright (C) 2014 Simon D. Levy
+
+This code is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this code.  If not, see <http:#www.gnu.org/licenses/>.
+
+*/
+
+
+#ifdef _MSC_VER
+typedef __int64 int64_t;       /* Define it from MSVC's internal type */
+#else
+#include <stdint.h>            /* Use the C99 official header */
+#endif
+
+#include <math.h>
+
+#include "coreslam.h"
+#include "coreslam_internals.h"
+
+#ifdef CORESLAM_X86
+
+#include <immintrin.h>
+
+/* Positions scored together per pass over the scan in batch kernels */
+#define BATCH_POSITIONS 4
+
+/* Scale a position into pixels, including 0.5 for rounding */
+static void 
+position_to_pixels(
+    map_t * map, 
+    position_t position, 
+    double * costheta, 
+    double * sintheta, 
+    double * pos_x_pix, 
+    double * pos_y_pix)
+{
+    double position_theta_radians = radians(position.theta_degrees);
+    *costheta = cos(position_theta_radians) * map->scale_pixels_per_mm;
+    *sintheta = sin(position_theta_radians) * map->scale_pixels_per_mm;
+
+    *pos_x_pix = position.x_mm * map->scale_pixels_per_mm + 0.5;
+    *pos_y_pix = position.y_mm * map->scale_pixels_per_mm + 0.5;
+}
+
+/* AVX-512 ----------------------------------------------------------------- */
+
+typedef struct avx512_state
+{
+    __m512 costheta_16;
+    __m512 sintheta_16;
+    __m512 pos_x_16;
+    __m512 pos_y_16;
+
+    __m512i sum_8;      /* 64-bit sums of map values */
+    __m512i npoints_16; /* counts of points in map bounds */
+
+    int in_map;         /* nonzero if every scan point falls in the map */
+
+} avx512_state_t;
+
+KERNEL_TARGET("avx512f")
+static void
+avx512_init(avx512_state_t * state, map_t * map, scan_t * scan, position_t position)
+{
+    double costheta, sintheta, pos_x_pix, pos_y_pix;
+    position_to_pixels(map, position, &costheta, &sintheta, &pos_x_pix, &pos_y_pix);
+
+    state->costheta_16 = _mm512_set1_ps((float)costheta);
+    state->sintheta_16 = _mm512_set1_ps((float)sintheta);
+    state->pos_x_16    = _mm512_set1_ps((float)pos_x_pix);
+    state->pos_y_16    = _mm512_set1_ps((float)pos_y_pix);
+
+    state->sum_8       = _mm512_setzero_si512();
+    state->npoints_16  = _mm512_setzero_si512();
+
+    state->in_map      = scan_in_map(map, scan, pos_x_pix, pos_y_pix);
+}
+
+/* Adds the map values at up to 16 points to the sums for one position */
+KERNEL_TARGET("avx512f")
+static inline void
+avx512_add(
+    avx512_state_t * state, 
+    map_t * map, 
+    __m512i x, 
+    __m512i y, 
+    __mmask16 valid)
+{
+    __m512i size_16 = _mm512_set1_epi32(map->size_pixels);
+
+    /* Unsigned comparison rejects negative coordinates as well */
+    __mmask16 inbounds = valid;
+    if (!state->in_map)
+    {
+        inbounds = _mm512_mask_cmplt_epu32_mask(inbounds, x, size_16);
+        inbounds = _mm512_mask_cmplt_epu32_mask(inbounds, y, size_16);
+    }
+
+    /* Gather pixels through 32-bit loads, keeping the low bits */
+    __m512i offset = _mm512_add_epi32(_mm512_mullo_epi32(y, size_16), x);
+    __m512i pixels = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), inbounds, offset, map->pixels, sizeof(pixel_t));
+    pixels = _mm512_and_si512(pixels, _mm512_set1_epi32(PIXEL_MASK));
+
+    state->sum_8 = _mm512_add_epi64(state->sum_8, _mm512_cvtepu32_epi64(_mm512_castsi512_si256(pixels)));
+    state->sum_8 = _mm512_add_epi64(state->sum_8, _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(pixels, 1)));
+
+    state->npoints_16 = _mm512_mask_add_epi32(state->npoints_16, inbounds, state->npoints_16, _mm512_set1_epi32(1));
+}
+
+/* Scores up to 16 scan points against the map for one position */
+KERNEL_TARGET("avx512f")
+static inline void
+avx512_score(
+    avx512_state_t * state, 
+    map_t * map, 
+    __m512 scan_x_16, 
+    __m512 scan_y_16, 
+    __mmask16 valid)
+{
+    /* Translate and rotate 16 scan points to robot position, rounding down */
+    __m512 xf = _mm512_fmadd_ps(state->costheta_16, scan_x_16, 
+                                _mm512_fnmadd_ps(state->sintheta_16, scan_y_16, state->pos_x_16));
+    __m512 yf = _mm512_fmadd_ps(state->sintheta_16, scan_x_16, 
+                                _mm512_fmadd_ps(state->costheta_16, scan_y_16, state->pos_y_16));
+
+    avx512_add(state, map,
+               _mm512_cvt_roundps_epi32(xf, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC),
+               _mm512_cvt_roundps_epi32(yf, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC),
+               valid);
+}
+
+KERNEL_TARGET("avx512f")
+static int
+avx512_distance(avx512_state_t * state)
+{
+    int npoints = _mm512_reduce_add_epi32(state->npoints_16); /* number of points where scan matches map */
+    int64_t sum = _mm512_reduce_add_epi64(state->sum_8);      /* sum of map values at those points */
+
+    /* Return sum scaled by number of points, or -1 if none */
+    return npoints ? (int)(sum * 1024 / npoints) : -1;
+}
+
+/* Mask off lanes past the last obstacle point */
+KERNEL_TARGET("avx512f")
+static inline __mmask16
+avx512_valid(int npoints, int i)
+{
+    int remaining = npoints - i;
+    return remaining >= 16 ? 0xFFFF : (__mmask16)((1 << remaining) - 1);
+}
+
+KERNEL_TARGET("avx512f")
+int
+distance_scan_to_map_avx512(
+    map_t *  map,
+    scan_t * scan,
+    position_t position)
+{
+    avx512_state_t state;
+    avx512_init(&state, map, scan, position);
+
+    int i = 0;
+    for (i=0; i<scan->obst_npoints; i+=16)
+    {
+        __mmask16 valid = avx512_valid(scan->obst_npoints, i);
+
+        avx512_score(&state, map, 
+                     _mm512_maskz_loadu_ps(valid, &scan->obst_x_mm[i]), 
+                     _mm512_maskz_loadu_ps(valid, &scan->obst_y_mm[i]), 
+                     valid);
+    }
+
+    return avx512_distance(&state);
+}
+
+KERNEL_TARGET("avx512f")
+void
+distance_scan_to_map_batch_avx512(
+    map_t *  map,
+    scan_t * scan,
+    position_t * positions,
+    int npositions,
+    int * distances)
+{
+    int p = 0;
+    for (p=0; p<npositions; p+=BATCH_POSITIONS)
+    {
+        avx512_state_t states[BATCH_POSITIONS];
+
+        /* Pad a short final batch by repeating its last position */
+        int k = 0;
+        for (k=0; k<BATCH_POSITIONS; ++k)
+        {
+            avx512_init(&states[k], map, scan, positions[p+k < npositions ? p+k : npositions-1]);
+        }
+
+        int i = 0;
+        for (i=0; i<scan->obst_npoints; i+=16)
+        {
+            __mmask16 valid = avx512_valid(scan->obst_npoints, i);
+
+            __m512 scan_x_16 = _mm512_maskz_loadu_ps(valid, &scan->obst_x_mm[i]);
+            __m512 scan_y_16 = _mm512_maskz_loadu_ps(valid, &scan->obst_y_mm[i]);
+
+            for (k=0; k<BATCH_POSITIONS; ++k)
+            {
+                avx512_score(&states[k], map, scan_x_16, scan_y_16, valid);
+            }
+        }
+
+        for (k=0; k<BATCH_POSITIONS && p+k<npositions; ++k)
+        {
+            distances[p+k] = avx512_distance(&states[k]);
+        }
+    }
+}
+
+KERNEL_TARGET("avx512f")
+int
+distance_scan_to_map_bounded_avx512(
+    map_t *  map,
+    scan_t * scan,
+    position_t position,
+    int bound)
+{
+    avx512_state_t state;
+    avx512_init(&state, map, scan, position);
+
+    int i = 0;
+    for (i=0; i<scan->obst_npoints; i+=16)
+    {
+        __mmask16 valid = avx512_valid(scan->obst_npoints, i);
+
+        avx512_score(&state, map, 
+                     _mm512_maskz_loadu_ps(valid, &scan->obst_x_mm[i]), 
+                     _mm512_maskz_loadu_ps(valid, &scan->obst_y_mm[i]), 
+                     valid);
+
+        /* Give up once this position cannot beat the bound */
+        if ((i + 16) % BOUND_CHECK_POINTS == 0 && 
+            bound_reached(_mm512_reduce_add_epi64(state.sum_8), bound, scan->obst_npoints))
+        {
+            return bound;
+        }
+    }
+
+    return avx512_distance(&state);
+}
+
+KERNEL_TARGET("avx512f")
+int
+distance_rotated_scan_to_map_avx512(
+    map_t *  map,
+    int * rotated_x,
+    int * rotated_y,
+    int npoints,
+    int pos_x,
+    int pos_y,
+    int shift,
+    int bound,
+    int in_map)
+{
+    avx512_state_t state;
+    state.sum_8      = _mm512_setzero_si512();
+    state.npoints_16 = _mm512_setzero_si512();
+    state.in_map     = in_map;
+
+    __m512i pos_x_16 = _mm512_set1_epi32(pos_x);
+    __m512i pos_y_16 = _mm512_set1_epi32(pos_y);
+    __m128i shift_1  = _mm_cvtsi32_si128(shift);
+
+    int i = 0;
+    for (i=0; i<npoints; i+=16)
+    {
+        __mmask16 valid = avx512_valid(npoints, i);
+
+        /* Translate 16 rotated scan points to robot position, rounding down */
+        __m512i x = _mm512_sra_epi32(_mm512_add_epi32(pos_x_16, _mm512_maskz_loadu_epi32(valid, &rotated_x[i])), 
+                                     shift_1);
+        __m512i y = _mm512_sra_epi32(_mm512_add_epi32(pos_y_16, _mm512_maskz_loadu_epi32(valid, &rotated_y[i])), 
+                                     shift_1);
+
+        avx512_add(&state, map, x, y, valid);
+
+        /* Give up once this position cannot beat the bound */
+        if ((i + 16) % BOUND_CHECK_POINTS == 0 && 
+            bound_reached(_mm512_reduce_add_epi64(state.sum_8), bound, npoints))
+        {
+            return bound;
+        }
+    }
+
+    return avx512_distance(&state);
+}
+
+/* AVX2 -------------------------------------------------------------------- */
+
+typedef struct avx2_state
+{
+    __m256 costheta_8;
+    __m256 sintheta_8;
+    __m256 pos_x_8;
+    __m256 pos_y_8;
+
+    __m256i sum_4;      /* 64-bit sums of map values */
+    __m256i npoints_8;  /* negated counts of points in map bounds */
+
+    int in_map;         /* nonzero if every scan point falls in the map */
+
+} avx2_state_t;
+
+KERNEL_TARGET("avx2,fma")
+static void
+avx2_init(avx2_state_t * state, map_t * map, scan_t * scan, position_t position)
+{
+    double costheta, sintheta, pos_x_pix, pos_y_pix;
+    position_to_pixels(map, position, &costheta, &sintheta, &pos_x_pix, &pos_y_pix);
+
+    state->costheta_8 = _mm256_set1_ps((float)costheta);
+    state->sintheta_8 = _mm256_set1_ps((float)sintheta);
+    state->pos_x_8    = _mm256_set1_ps((float)pos_x_pix);
+    state->pos_y_8    = _mm256_set1_ps((float)pos_y_pix);
+
+    state->sum_4      = _mm256_setzero_si256();
+    state->npoints_8  = _mm256_setzero_si256();
+
+    state->in_map     = scan_in_map(map, scan, pos_x_pix, pos_y_pix);
+}
+
+/* Adds the map values at up to 8 points to the sums for one position */
+KERNEL_TARGET("avx2,fma")
+static inline void
+avx2_add(
+    avx2_state_t * state, 
+    map_t * map, 
+    __m256i x, 
+    __m256i y, 
+    __m256i valid)
+{
+    __m256i size_8   = _mm256_set1_epi32(map->size_pixels);
+    __m256i minus1_8 = _mm256_set1_epi32(-1);
+
+    /* Keep points in map bounds */
+    __m256i inbounds = valid;
+    if (!state->in_map)
+    {
+        inbounds = _mm256_and_si256(inbounds, _mm256_cmpgt_epi32(x, minus1_8));
+        inbounds = _mm256_and_si256(inbounds, _mm256_cmpgt_epi32(size_8, x));
+        inbounds = _mm256_and_si256(inbounds, _mm256_cmpgt_epi32(y, minus1_8));
+        inbounds = _mm256_and_si256(inbounds, _mm256_cmpgt_epi32(size_8, y));
+    }
+
+    /* Gather pixels through 32-bit loads, keeping the low bits */
+    __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(y, size_8), x);
+    __m256i pixels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+                                                 (const int *)map->pixels, offset, inbounds, sizeof(pixel_t));
+    pixels = _mm256_and_si256(pixels, _mm256_set1_epi32(PIXEL_MASK));
+
+    state->sum_4 = _mm256_add_epi64(state->sum_4, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(pixels)));
+    state->sum_4 = _mm256_add_epi64(state->sum_4, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(pixels, 1)));
+
+    /* In-bounds lanes are -1 */
+    state->npoints_8 = _mm256_sub_epi32(state->npoints_8, inbounds);
+}
+
+/* Scores up to 8 scan points against the map for one position */
+KERNEL_TARGET("avx2,fma")
+static inline void
+avx2_score(
+    avx2_state_t * state, 
+    map_t * map, 
+    __m256 scan_x_8, 
+    __m256 scan_y_8, 
+    __m256i valid)
+{
+    /* Translate and rotate 8 scan points to robot position, rounding down */
+    __m256 xf = _mm256_fmadd_ps(state->costheta_8, scan_x_8, 
+                                _mm256_fnmadd_ps(state->sintheta_8, scan_y_8, state->pos_x_8));
+    __m256 yf = _mm256_fmadd_ps(state->sintheta_8, scan_x_8, 
+                                _mm256_fmadd_ps(state->costheta_8, scan_y_8, state->pos_y_8));
+
+    avx2_add(state, map, _mm256_cvttps_epi32(_mm256_floor_ps(xf)), _mm256_cvttps_epi32(_mm256_floor_ps(yf)), valid);
+}
+
+KERNEL_TARGET("avx2,fma")
+static int64_t
+avx2_sum(avx2_state_t * state)
+{
+    int64_t sum_arr[4];
+    _mm256_storeu_si256((__m256i *)sum_arr, state->sum_4);
+
+    return sum_arr[0] + sum_arr[1] + sum_arr[2] + sum_arr[3];
+}
+
+KERNEL_TARGET("avx2,fma")
+static int
+avx2_distance(avx2_state_t * state)
+{
+    int npoints = 0;                 /* number of points where scan matches map */
+    int64_t sum = avx2_sum(state);   /* sum of map values at those points */
+
+    int32_t npoints_arr[8];
+    _mm256_storeu_si256((__m256i *)npoints_arr, state->npoints_8);
+
+    int j;
+    for (j=0; j<8; ++j)
+    {
+        npoints += npoints_arr[j];
+    }
+
+    /* Return sum scaled by number of points, or -1 if none */
+    return npoints ? (int)(sum * 1024 / npoints) : -1;
+}
+
+/* Mask off lanes past the last obstacle point */
+KERNEL_TARGET("avx2,fma")
+static inline __m256i
+avx2_valid(int npoints, int i)
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(npoints - i), 
+                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+KERNEL_TARGET("avx2,fma")
+int
+distance_scan_to_map_avx2(
+    map_t *  map,
+    scan_t * scan,
+    position_t position)
+{
+    avx2_state_t state;
+    avx2_init(&state, map, scan, position);
+
+    int i = 0;
+    for (i=0; i<scan->obst_npoints; i+=8)
+    {
+        __m256i valid = avx2_valid(scan->obst_npoints, i);
+
+        avx2_score(&state, map, 
+                   _mm256_maskload_ps(&scan->obst_x_mm[i], valid), 
+                   _mm256_maskload_ps(&scan->obst_y_mm[i], valid), 
+                   valid);
+    }
+
+    return avx2_distance(&state);
+}
+
+KERNEL_TARGET("avx2,fma")
+void
+distance_scan_to_map_batch_avx2(
+    map_t *  map,
+    scan_t * scan,
+    position_t * positions,
+    int npositions,
+    int * distances)
+{
+    int p = 0;
+    for (p=0; p<npositions; p+=BATCH_POSITIONS)
+    {
+        avx2_state_t states[BATCH_POSITIONS];
+
+        /* Pad a short final batch by repeating its last position */
+        int k = 0;
+        for (k=0; k<BATCH_POSITIONS; ++k)
+        {
+            avx2_init(&states[k], map, scan, positions[p+k < npositions ? p+k : npositions-1]);
+        }
+
+        int i = 0;
+        for (i=0; i<scan->obst_npoints; i+=8)
+        {
+            __m256i valid = avx2_valid(scan->obst_npoints, i);
+
+            __m256 scan_x_8 = _mm256_maskload_ps(&scan->obst_x_mm[i], valid);
+            __m256 scan_y_8 = _mm256_maskload_ps(&scan->obst_y_mm[i], valid);
+
+            for (k=0; k<BATCH_POSITIONS; ++k)
+            {
+                avx2_score(&states[k], map, scan_x_8, scan_y_8, valid);
+            }
+        }
+
+        for (k=0; k<BATCH_POSITIONS && p+k<npositions; ++k)
+        {
+            distances[p+k] = avx2_distance(&states[k]);
+        }
+    }
+}
+
+KERNEL_TARGET("avx2,fma")
+int
+distance_scan_to_map_bounded_avx2(
+    map_t *  map,
+    scan_t * scan,
+    position_t position,
+    int bound)
+{
+    avx2_state_t state;
+    avx2_init(&state, map, scan, position);
+
+    int i = 0;
+    for (i=0; i<scan->obst_npoints; i+=8)
+    {
+        __m256i valid = avx2_valid(scan->obst_npoints, i);
+
+        avx2_score(&state, map, 
+                   _mm256_maskload_ps(&scan->obst_x_mm[i], valid), 
+                   _mm256_maskload_ps(&scan->obst_y_mm[i], valid), 
+                   valid);
+
+        /* Give up once this position cannot beat the bound */
+        if ((i + 8) % BOUND_CHECK_POINTS == 0 && bound_reached(avx2_sum(&state), bound, scan->obst_npoints))
+        {
+            return bound;
+        }
+    }
+
+    return avx2_distance(&state);
+}
+
+KERNEL_TARGET("avx2,fma")
+int
+distance_rotated_scan_to_map_avx2(
+    map_t *  map,
+    int * rotated_x,
+    int * rotated_y,
+    int npoints,
+    int pos_x,
+    int pos_y,
+    int shift,
+    int bound,
+    int in_map)
+{
+    avx2_state_t state;
+    state.sum_4     = _mm256_setzero_si256();
+    state.npoints_8 = _mm256_setzero_si256();
+    state.in_map    = in_map;
+
+    __m256i pos_x_8 = _mm256_set1_epi32(pos_x);
+    __m256i pos_y_8 = _mm256_set1_epi32(pos_y);
+    __m128i shift_1 = _mm_cvtsi32_si128(shift);
+
+    int i = 0;
+    for (i=0; i<npoints; i+=8)
+    {
+        __m256i valid = avx2_valid(npoints, i);
+
+        /* Translate 8 rotated scan points to robot position, rounding down */
+        __m256i x = _mm256_sra_epi32(_mm256_add_epi32(pos_x_8, _mm256_maskload_epi32(&rotated_x[i], valid)), 
+                                     shift_1);
+        __m256i y = _mm256_sra_epi32(_mm256_add_epi32(pos_y_8, _mm256_maskload_epi32(&rotated_y[i], valid)), 
+                                     shift_1);
+
+        avx2_add(&state, map, x, y, valid);
+
+        /* Give up once this position cannot beat the bound */
+        if ((i + 8) % BOUND_CHECK_POINTS == 0 && bound_reached(avx2_sum(&state), bound, npoints))
+        {
+            return bound;
+        }
+    }
+
+    return avx2_distance(&state);
+}
+
+#endif
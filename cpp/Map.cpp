@@ -32,16 +32,67 @@ using namespace std;
 #include "Scan.hpp"
 #include "Position.hpp"
 #include "Map.hpp"
+#include "ThreadPool.hpp"
 
 Map::Map(int size_pixels, double size_meters)
 {
     this->map = new map_t;
     map_init(this->map, size_pixels, size_meters);
+    
+    this->update_pool = NULL;
+}
+
+Map::Map(int size_pixels, double size_meters, bool sparse)
+{
+    this->map = new map_t;
+    
+    if (sparse)
+    {
+        map_init_sparse(this->map, size_pixels, size_meters);
+    }
+    else
+    {
+        map_init(this->map, size_pixels, size_meters);
+    }
+    
+    this->update_pool = NULL;
+}
+
+Map::Map(void)
+{
+    this->map = new map_t;
+    this->update_pool = NULL;
+}
+
+Map * Map::open(const char * filename, int mode)
+{
+    Map * map = new Map();
+    
+    if (map_open(map->map, filename, mode))
+    {
+        // Nothing to free in the C map
+        delete map->map;
+        map->map = NULL;
+        delete map;
+        return NULL;
+    }
+    
+    return map;
+}
+
+bool Map::save(const char * filename) const
+{
+    return map_save(this->map, filename) == 0;
 }
 
 Map::~Map(void)
 {
-    map_free(this->map);
+    delete this->update_pool;
+    
+    if (this->map)
+    {
+        map_free(this->map);
+    }
     delete this->map;
 }
 
@@ -56,14 +107,67 @@ void Map::update(
     cpos.y_mm = position.y_mm;
     cpos.theta_degrees = position.theta_degrees;
     
-    map_update(this->map, scan.scan, cpos, quality, hole_width_mm);
+    // A read-only map refuses the update once, in map_update
+    if (this->update_pool && !this->map->read_only)
+    {
+        // Split the rings around the position into bands with about the same work
+        int nparts = this->update_pool->size();
+        vector<int> bounds(nparts+1);
+        map_update_ring_bounds(this->map, scan.scan, cpos, hole_width_mm, nparts, &bounds[0]);
+        
+        this->update_pool->run(nparts, [&](int k)
+        {
+            map_update_rings(this->map, scan.scan, cpos, quality, hole_width_mm, bounds[k], bounds[k+1]);
+        });
+        
+        map_update_finish(this->map, scan.scan, cpos, hole_width_mm);
+    }
+    
+    else
+    {
+        map_update(this->map, scan.scan, cpos, quality, hole_width_mm);
+    }
 }
 
-void Map::get(char * bytes)
+void Map::get(char * bytes) const
 {
     map_get(this->map, bytes);
 }
 
+unsigned Map::getVersion(void) const
+{
+    return this->map->version;
+}
+
+int Map::getTiles(unsigned since_version, int * tiles, char * bytes) const
+{
+    return map_get_tiles(this->map, since_version, tiles, bytes);
+}
+
+int Map::tileCount(void) const
+{
+    return this->map->size_tiles * this->map->size_tiles;
+}
+
+void Map::setUpdateThreads(int nthreads)
+{
+    int current = this->update_pool ? this->update_pool->size() : 1;
+    
+    if (nthreads != current)
+    {
+        delete this->update_pool;
+        this->update_pool = nthreads > 1 ? new ThreadPool(nthreads) : NULL;
+    }
+}
+
+void Map::setPyramidLevels(int nlevels)
+{
+    if (nlevels != this->map->pyramid_levels)
+    {
+        map_init_pyramid(this->map, nlevels);
+    }
+}
+
 
 ostream& operator<< (ostream & out, Map & map)
 {
@@ -25,11 +25,16 @@
 #include <iostream>
 using namespace std; 
 
+#ifdef BREEZYSLAM_MAP8
+typedef unsigned char pixel_t;
+#else
 typedef unsigned short pixel_t;
+#endif
 
 
 class Scan;
 class Position;
+class ThreadPool;
 
 /**
 * A class for maps used in SLAM.
@@ -39,6 +44,7 @@ class Map
     friend class CoreSLAM;
     friend class SinglePositionSLAM;
     friend class RMHC_SLAM;
+    friend class BranchAndBound_SLAM;
         
 public:
     
@@ -50,6 +56,47 @@ public:
 */
 Map(int size_pixels, double size_meters);
 
+/**
+* Builds a square Map object, optionally sparse: a sparse map allocates each tile of 
+* MAP_TILE_SIZE_PIXELS (64) pixels on a side only when it is first written, so its memory 
+* grows with the area explored rather than the size of the map.
+* @param size_pixels  size in pixels
+* @param size_meters  size in meters
+* @param sparse  true for a sparse map
+* 
+*/
+Map(int size_pixels, double size_meters, bool sparse);
+
+
+/**
+* Ways for open() to give a map the pixels of a file: reading them into memory, mapping the file
+* into memory read-only and shared with other processes, or mapping it and copying pages as they
+* change.
+*/
+static const int OPEN_COPY = 0;
+static const int OPEN_READ_ONLY = 1;
+static const int OPEN_COPY_ON_WRITE = 2;
+
+/**
+* Builds a Map object from a file written by save().  Mapping the file into memory takes no time 
+* however big the map, and processes mapping the same file share one copy of its unchanged pixels.
+* A read-only map is never changed by update().
+* @param filename name of the file
+* @param mode OPEN_COPY, OPEN_READ_ONLY, or OPEN_COPY_ON_WRITE
+* @return a new Map object, or NULL if the file cannot be opened as a map or the mode is unknown
+* 
+*/
+static Map * open(const char * filename, int mode);
+
+/**
+* Saves this map to a file, with a header giving its format version, byte order, size in pixels 
+* and meters, pixel size, and origin, for open().  The file can be opened only on machines with
+* the same byte order.
+* @param filename name of the file
+* @return true on success, false on failure
+* 
+*/
+bool save(const char * filename) const;
 
 /**
 * Deallocates this Map object.
@@ -62,7 +109,45 @@ Map(int size_pixels, double size_meters);
 * Puts current map values into bytearray, which should of which should be of 
 * this->size map_size_pixels ^ 2.
 */
-void get(char * bytes);
+void get(char * bytes) const;
+
+/**
+* Returns the version of this map, which goes up with every update.
+*/
+unsigned getVersion(void) const;
+
+/**
+* Puts the map values of the tiles changed since the map had the given version into bytearray,
+* like get(), so that a copy of the map can be kept up to date by copying only what changed.  
+* Tiles are square with MAP_TILE_SIZE_PIXELS (64) pixels on a side, stored one after the other 
+* row by row, and padded with zeros beyond the edge of the map.
+* @param since_version the version returned by getVersion() at the last copy, or 0 for all tiles
+* @param tiles receives the index of each tile, numbered row by row; should hold tileCount() values
+* @param bytes receives the tile pixels; should hold tileCount() tiles
+* @return the number of tiles copied
+*/
+int getTiles(unsigned since_version, int * tiles, char * bytes) const;
+
+/**
+* Returns the number of tiles in this map.
+*/
+int tileCount(void) const;
+
+/**
+* Maintains a pyramid of maps at 1/2, 1/4, ... this map's resolution, for coarse-to-fine 
+* search.  Each pyramid pixel holds the minimum of the pixels it covers.
+* @param nlevels number of levels; 0 removes the pyramid
+* 
+*/
+void setPyramidLevels(int nlevels);
+
+/**
+* Sets the number of threads used by update().  Each thread updates the pixels within its 
+* own band of distances from the robot, so the updated map is the same for any number of threads.
+* @param nthreads number of threads; 1 (the default) updates the map on the calling thread
+* 
+*/
+void setUpdateThreads(int nthreads);
 
 /**
 * Updates this map object based on new data.
@@ -83,6 +168,10 @@ friend ostream& operator<< (ostream & out, Map & map);
 
 private:
     
+    Map(void);
+    
     struct map_t * map;
+    
+    ThreadPool * update_pool;
 };
 
@@ -77,16 +77,29 @@ Scan::update(
     int * scanvals_mm, 
     double hole_width_millimeters,
     PoseChange & poseChange)
+{
+    this->update(scanvals_mm, NULL, this->scan->size, hole_width_millimeters, poseChange);
+}
+
+void 
+Scan::update(
+    int * scanvals_mm, 
+    float * scan_angles_degrees,
+    int scan_size,
+    double hole_width_millimeters,
+    PoseChange & poseChange)
 {
     scan_update(
         this->scan,
-        NULL, // no support for angles/interpolation yet
+        scan_angles_degrees,
         scanvals_mm,
-        this->scan->size,// no support for angles/interpolation yet
+        scan_size,
         hole_width_millimeters,
         poseChange.dxy_mm,
         poseChange.dtheta_degrees);
 }
+
+
 void 
 Scan::update(
     int * scanvals_mm, 
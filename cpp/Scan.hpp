@@ -39,6 +39,7 @@ class Scan
     friend class Map;
     friend class CoreSLAM;
     friend class RMHC_SLAM;
+    friend class BranchAndBound_SLAM;
         
 public:
     
@@ -90,6 +91,24 @@ update(
     double hole_width_millimeters,
     PoseChange & poseChange);
 
+/**
+* Updates this Scan object with new values from a Lidar scan taken at arbitrary angles, 
+* resampling the distances to one per degree.
+* @param scanvals_mm scanned Lidar distance values in millimeters
+* @param scan_angles_degrees angle of each distance value, in any order
+* @param scan_size number of distance values (at most the Laser object's <tt>scan_size</tt>)
+* @param hole_width_millimeters hole width in millimeters
+* @param poseChange forward velocity and angular velocity of robot at scan time
+* 
+*/
+void 
+update(
+    int * scanvals_mm, 
+    float * scan_angles_degrees,
+    int scan_size,
+    double hole_width_millimeters,
+    PoseChange & poseChange);
+
 friend ostream& operator<< (ostream & out, Scan & scan);
 
 private:
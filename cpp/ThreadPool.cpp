@@ -0,0 +1,150 @@
+/**
+*
+* BreezySLAM: Simple, efficient SLAM in C++
+*
+* ThreadPool.cpp - implementation for ThreadPool class
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(int nthreads)
+{
+    this->ntasks = 0;
+    this->next_task = 0;
+    this->unfinished_tasks = 0;
+    this->generation = 0;
+    this->stopping = false;
+
+    // The calling thread does its share of the work in run()
+    for (int k=1; k<nthreads; ++k)
+    {
+        this->workers.push_back(thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool(void)
+{
+    {
+        unique_lock<mutex> guard(this->lock);
+        this->stopping = true;
+    }
+
+    this->work_ready.notify_all();
+
+    for (unsigned k=0; k<this->workers.size(); ++k)
+    {
+        this->workers[k].join();
+    }
+}
+
+void ThreadPool::run(int ntasks, function<void(int)> task)
+{
+    unique_lock<mutex> guard(this->lock);
+
+    this->startTasks(ntasks, task, guard);
+
+    this->runTasks(guard);
+
+    while (this->unfinished_tasks > 0)
+    {
+        this->work_done.wait(guard);
+    }
+}
+
+void ThreadPool::start(int ntasks, function<void(int)> task)
+{
+    unique_lock<mutex> guard(this->lock);
+
+    this->startTasks(ntasks, task, guard);
+}
+
+void ThreadPool::wait(void)
+{
+    unique_lock<mutex> guard(this->lock);
+
+    while (this->unfinished_tasks > 0)
+    {
+        this->work_done.wait(guard);
+    }
+}
+
+int ThreadPool::size(void)
+{
+    return this->workers.size() + 1;
+}
+
+void ThreadPool::work(void)
+{
+    unique_lock<mutex> guard(this->lock);
+
+    // Workers start before any tasks, so a batch handed out before this thread first waits counts
+    unsigned last_generation = 0;
+
+    while (true)
+    {
+        while (!this->stopping && this->generation == last_generation)
+        {
+            this->work_ready.wait(guard);
+        }
+
+        if (this->stopping)
+        {
+            return;
+        }
+
+        last_generation = this->generation;
+
+        this->runTasks(guard);
+    }
+}
+
+// Hands out a new batch of tasks to the workers once any earlier batch has finished; called with 
+// the lock held
+void ThreadPool::startTasks(int ntasks, function<void(int)> & task, unique_lock<mutex> & guard)
+{
+    while (this->unfinished_tasks > 0)
+    {
+        this->work_done.wait(guard);
+    }
+
+    this->task = task;
+    this->ntasks = ntasks;
+    this->next_task = 0;
+    this->unfinished_tasks = ntasks;
+    this->generation++;
+
+    this->work_ready.notify_all();
+}
+
+// Claims and runs tasks until none are left; called with the lock held
+void ThreadPool::runTasks(unique_lock<mutex> & guard)
+{
+    while (this->next_task < this->ntasks)
+    {
+        int k = this->next_task++;
+
+        guard.unlock();
+        this->task(k);
+        guard.lock();
+
+        if (--this->unfinished_tasks == 0)
+        {
+            this->work_done.notify_all();
+        }
+    }
+}
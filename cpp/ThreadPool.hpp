@@ -0,0 +1,101 @@
+/**
+*
+* BreezySLAM: Simple, efficient SLAM in C++
+*
+* ThreadPool.hpp - header for ThreadPool class
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+using namespace std;
+
+
+/**
+* A fixed-size pool of worker threads for running a batch of indexed tasks in parallel.
+*/
+class ThreadPool
+{
+public:
+
+/**
+* Builds a ThreadPool object.
+* @param nthreads total number of threads used by run(), including the calling thread
+*
+*/
+ThreadPool(int nthreads);
+
+/**
+* Stops the worker threads and deallocates this ThreadPool object.
+*
+*/
+~ThreadPool(void);
+
+/**
+* Runs task(0) through task(ntasks-1) on the pool threads and the calling thread,
+* returning when all have finished.  Tasks are handed out in index order, once any tasks given
+* to start() have finished.
+* @param ntasks number of tasks
+* @param task function to call with each task index
+*
+*/
+void run(int ntasks, function<void(int)> task);
+
+/**
+* Starts task(0) through task(ntasks-1) on the worker threads alone, returning at once, so that
+* they run in the background; the pool must have at least two threads.  Waits first for any 
+* tasks started earlier to finish.
+* @param ntasks number of tasks
+* @param task function to call with each task index
+*
+*/
+void start(int ntasks, function<void(int)> task);
+
+/**
+* Waits for the tasks given to start() to finish.  Returns at once if there are none.
+*/
+void wait(void);
+
+/**
+* Returns the total number of threads used by run().
+*/
+int size(void);
+
+private:
+
+    vector<thread> workers;
+
+    mutex lock;
+    condition_variable work_ready;
+    condition_variable work_done;
+
+    function<void(int)> task;
+    int ntasks;
+    int next_task;
+    int unfinished_tasks;
+    unsigned generation;
+    bool stopping;
+
+    void work(void);
+
+    void startTasks(int ntasks, function<void(int)> & task, unique_lock<mutex> & guard);
+
+    void runTasks(unique_lock<mutex> & guard);
+};
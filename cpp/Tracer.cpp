@@ -0,0 +1,190 @@
+/**
+*
+* BreezySLAM: Simple, efficient SLAM in C++
+*
+* Tracer.cpp - C++ code for Tracer class
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "Tracer.hpp"
+
+static atomic<unsigned long> next_tracer_id(1);
+
+Tracer * Tracer::open(const char * filename)
+{
+    FILE * fp = fopen(filename, "w");
+
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    return new Tracer(fp);
+}
+
+Tracer::Tracer(FILE * fp) :
+threads(NULL),
+nthreads(0)
+{
+    this->fp = fp;
+    this->start_us = Tracer::now();
+    this->id = next_tracer_id++;
+
+    // Every event follows a comma, so buffers can be written in any order as they fill
+    fprintf(this->fp, "{\"traceEvents\":[\n");
+    fprintf(this->fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"BreezySLAM\"}}");
+}
+
+Tracer::~Tracer(void)
+{
+    this->close();
+
+    ThreadBuffer * next_buffer = NULL;
+    for (ThreadBuffer * buffer = this->threads.load(); buffer; buffer = next_buffer)
+    {
+        next_buffer = buffer->next;
+        delete buffer;
+    }
+}
+
+double Tracer::now(void)
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Tracer::ThreadBuffer * Tracer::buffer(void)
+{
+    // Each thread remembers its buffer in the tracer it used last
+    static thread_local unsigned long cached_id = 0;
+    static thread_local ThreadBuffer * cached_buffer = NULL;
+
+    if (cached_id == this->id)
+    {
+        return cached_buffer;
+    }
+
+    // Only this thread adds a buffer it owns, so it cannot race with itself to add two
+    thread::id owner = this_thread::get_id();
+    ThreadBuffer * buffer = this->threads.load(memory_order_acquire);
+    while (buffer && buffer->owner != owner)
+    {
+        buffer = buffer->next;
+    }
+
+    if (!buffer)
+    {
+        buffer = new ThreadBuffer;
+        buffer->owner = owner;
+        buffer->tid = ++this->nthreads;
+        buffer->count.store(0, memory_order_relaxed);
+
+        // Push onto the list of buffers
+        buffer->next = this->threads.load(memory_order_relaxed);
+        while (!this->threads.compare_exchange_weak(buffer->next, buffer,
+                                                    memory_order_release, memory_order_relaxed))
+        {
+        }
+    }
+
+    cached_id = this->id;
+    cached_buffer = buffer;
+
+    return buffer;
+}
+
+void Tracer::add(const char * name, int scan, double start_us)
+{
+    double end_us = Tracer::now();
+
+    ThreadBuffer * buffer = this->buffer();
+    int count = buffer->count.load(memory_order_relaxed);
+
+    if (count == BUFFER_EVENTS)
+    {
+        unique_lock<mutex> guard(this->fp_lock);
+
+        // A span ending after close() is dropped
+        if (this->fp)
+        {
+            this->write(buffer, count);
+        }
+
+        count = 0;
+    }
+
+    Event & event = buffer->events[count];
+    event.name = name;
+    event.scan = scan;
+    event.start_us = start_us;
+    event.duration_us = end_us - start_us;
+
+    buffer->count.store(count + 1, memory_order_release);
+}
+
+// Writes the first count events of a buffer to the file; called with the file locked
+void Tracer::write(ThreadBuffer * buffer, int count)
+{
+    for (int k=0; k<count; ++k)
+    {
+        Event & event = buffer->events[k];
+
+        // Names are identifiers, so need no escaping
+        fprintf(this->fp,
+                ",\n{\"name\":\"%s\",\"cat\":\"slam\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":1,\"tid\":%d,\"args\":{\"scan\":%d}}",
+                event.name,
+                event.start_us - this->start_us,
+                event.duration_us,
+                buffer->tid,
+                event.scan);
+    }
+}
+
+bool Tracer::close(void)
+{
+    if (!this->fp)
+    {
+        return true;
+    }
+
+    unique_lock<mutex> guard(this->fp_lock);
+
+    for (ThreadBuffer * buffer = this->threads.load(memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        int count = buffer->count.load(memory_order_acquire);
+
+        this->write(buffer, count);
+
+        buffer->count.store(0, memory_order_relaxed);
+    }
+
+    fprintf(this->fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    bool written = !ferror(this->fp);
+
+    if (fclose(this->fp))
+    {
+        written = false;
+    }
+    this->fp = NULL;
+
+    return written;
+}
@@ -0,0 +1,153 @@
+/**
+*
+* BreezySLAM: Simple, efficient SLAM in C++
+*
+* Tracer.hpp - header for Tracer and TraceSpan classes
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+
+/**
+* Records timed spans of work as Chrome trace events, for viewing a timeline of each thread in
+* chrome://tracing or https://ui.perfetto.dev.  Each thread appends to a buffer of its own,
+* without locking, so recording a span costs two clock reads and a few stores; a thread whose
+* buffer is full writes it to the file and starts it over, so a long trace takes no more memory
+* than a short one.
+*/
+class Tracer
+{
+public:
+
+/**
+* Creates a Tracer that will write to a file.
+* @param filename name of the file, conventionally ending in .json
+* @return a new Tracer object, or NULL if the file cannot be created
+*/
+static Tracer * open(const char * filename);
+
+/**
+* Closes the file, writing it first if close() has not been called, and deallocates this Tracer
+* object.
+*/
+~Tracer(void);
+
+/**
+* Writes the events still buffered, and closes the file.  Every thread that records spans must
+* have finished doing so.
+* @return true on success, false on failure to write the file
+*/
+bool close(void);
+
+/**
+* Records a span on the calling thread.  Safe to call from any thread.
+* @param name name of the span, which must outlive the tracer (e.g. a string literal) and need no
+* escaping in JSON
+* @param scan number of the scan the work was for
+* @param start_us when the span began, from now()
+*/
+void add(const char * name, int scan, double start_us);
+
+/**
+* Returns the time in microseconds from a monotonic clock.
+*/
+static double now(void);
+
+private:
+
+    static const int BUFFER_EVENTS = 1024;
+
+    struct Event
+    {
+        const char * name;
+        int scan;
+        double start_us;
+        double duration_us;
+    };
+
+    // Events are written only by the owning thread, which publishes each one by advancing count
+    struct ThreadBuffer
+    {
+        thread::id owner;
+        int tid;
+        Event events[BUFFER_EVENTS];
+        atomic<int> count;
+        ThreadBuffer * next;
+    };
+
+    Tracer(FILE * fp);
+
+    ThreadBuffer * buffer(void);
+
+    void write(ThreadBuffer * buffer, int count);
+
+    FILE * fp;
+
+    // Serializes writes to the file by the threads whose buffers fill
+    mutex fp_lock;
+
+    double start_us;
+
+    // Distinguishes this tracer from earlier ones at the same address in each thread's cache
+    unsigned long id;
+
+    atomic<ThreadBuffer *> threads;
+    atomic<int> nthreads;
+};
+
+/**
+* Records a span from its construction to its destruction, if given a tracer.
+*/
+class TraceSpan
+{
+public:
+
+/**
+* Starts a span.
+* @param tracer the tracer, or NULL to record nothing
+* @param name name of the span; see Tracer::add()
+* @param scan number of the scan the work is for
+*/
+TraceSpan(Tracer * tracer, const char * name, int scan)
+{
+    this->tracer = tracer;
+    this->name = name;
+    this->scan = scan;
+    this->start_us = tracer ? Tracer::now() : 0;
+}
+
+~TraceSpan(void)
+{
+    if (this->tracer)
+    {
+        this->tracer->add(this->name, this->scan, this->start_us);
+    }
+}
+
+private:
+
+    Tracer * tracer;
+    const char * name;
+    int scan;
+    double start_us;
+};
@@ -0,0 +1,159 @@
+/**
+*
+* BreezySLAM: Simple, efficient SLAM in C++
+*
+* UpdateStats.cpp - C++ code for UpdateStats class
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "UpdateStats.hpp"
+
+static const char * METRIC_NAMES[UpdateStats::NMETRICS] = 
+{
+    "scan_update",
+    "position_search",
+    "map_update",
+    "update",
+    "search_iterations",
+    "search_accepted",
+    "search_rejected",
+    "points_scored",
+    "search_cache_hits"
+};
+
+const char * UpdateStats::name(int metric)
+{
+    return METRIC_NAMES[metric];
+}
+
+UpdateStats::UpdateStats(int window)
+{
+    this->window = window;
+    
+    for (int k=0; k<NMETRICS; ++k)
+    {
+        this->next[k] = 0;
+    }
+}
+
+void UpdateStats::add(int metric, double value)
+{
+    lock_guard<mutex> guard(this->lock);
+    
+    vector<double> & samples = this->samples[metric];
+    
+    if ((int)samples.size() < this->window)
+    {
+        samples.push_back(value);
+    }
+    else
+    {
+        samples[this->next[metric]] = value;
+    }
+    
+    this->next[metric] = (this->next[metric] + 1) % this->window;
+}
+
+int UpdateStats::count(int metric)
+{
+    lock_guard<mutex> guard(this->lock);
+    
+    return this->samples[metric].size();
+}
+
+double UpdateStats::minimum(int metric)
+{
+    return this->percentile(metric, 0);
+}
+
+double UpdateStats::mean(int metric)
+{
+    lock_guard<mutex> guard(this->lock);
+    
+    vector<double> & samples = this->samples[metric];
+    
+    double sum = 0;
+    for (int k=0; k<(int)samples.size(); ++k)
+    {
+        sum += samples[k];
+    }
+    
+    return samples.empty() ? 0 : sum / samples.size();
+}
+
+double UpdateStats::percentile(int metric, double percent)
+{
+    vector<double> sorted;
+    {
+        lock_guard<mutex> guard(this->lock);
+        sorted = this->samples[metric];
+    }
+    
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    
+    // Nearest rank
+    int rank = (int)ceil(percent / 100 * sorted.size()) - 1;
+    rank = rank < 0 ? 0 : rank >= (int)sorted.size() ? sorted.size() - 1 : rank;
+    
+    nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    
+    return sorted[rank];
+}
+
+double UpdateStats::maximum(int metric)
+{
+    return this->percentile(metric, 100);
+}
+
+void UpdateStats::clear(void)
+{
+    lock_guard<mutex> guard(this->lock);
+    
+    for (int k=0; k<NMETRICS; ++k)
+    {
+        this->samples[k].clear();
+        this->next[k] = 0;
+    }
+}
+
+ostream& operator<< (ostream & out, UpdateStats & stats)
+{
+    char str[200];
+    
+    for (int k=0; k<UpdateStats::NMETRICS; ++k)
+    {
+        sprintf(str, "%-18s n=%-6d min=%-10.1f mean=%-10.1f p99=%-10.1f max=%.1f\n",
+            UpdateStats::name(k), 
+            stats.count(k), 
+            stats.minimum(k), 
+            stats.mean(k), 
+            stats.percentile(k, 99), 
+            stats.maximum(k));
+        
+        out << str;
+    }
+    
+    return out;
+}
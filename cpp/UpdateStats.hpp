@@ -0,0 +1,116 @@
+/**
+*
+* BreezySLAM: Simple, efficient SLAM in C++
+*
+* UpdateStats.hpp - header for UpdateStats class
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <vector>
+#include <mutex>
+using namespace std;
+
+
+/**
+* Rolling statistics of the stages of CoreSLAM::update(), over its most recent calls.  The stages
+* are timed, and the work of RMHC search counted, only when the library is built with
+* -DBREEZYSLAM_STATS ("make STATS=1"); otherwise no samples are ever added.
+*/
+class UpdateStats
+{
+public:
+
+/**
+* The metrics kept.  Times are in microseconds, from a monotonic clock; the rest are counts per update.
+*/
+static const int SCAN_UPDATE = 0;           // building the scans for mapping and for search
+static const int POSITION_SEARCH = 1;       // finding the new position
+static const int MAP_UPDATE = 2;            // integrating the scan into the map (on a background thread if async)
+static const int UPDATE = 3;                // all of update(), not counting a background map update
+static const int SEARCH_ITERATIONS = 4;     // RMHC candidate positions tried
+static const int SEARCH_ACCEPTED = 5;       // candidates that beat the best so far
+static const int SEARCH_REJECTED = 6;       // candidates that did not
+static const int POINTS_SCORED = 7;         // scan points given to the scorer, which may stop early
+static const int SEARCH_CACHE_HITS = 8;     // candidates given earlier scores (see RMHC_SLAM::cache_search_scores)
+
+static const int NMETRICS = 9;
+
+/**
+* Returns the name of a metric, e.g. "position_search".
+* @param metric one of the metrics above
+*/
+static const char * name(int metric);
+
+/**
+* Builds an UpdateStats object.
+* @param window number of most recent samples of each metric kept
+*
+*/
+UpdateStats(int window);
+
+/**
+* Adds a sample of a metric, replacing the oldest if the window is full.  Safe to call from any thread.
+* @param metric one of the metrics above
+* @param value the sample
+*/
+void add(int metric, double value);
+
+/**
+* Returns the number of samples of a metric in the window.
+*/
+int count(int metric);
+
+/**
+* Returns the smallest sample of a metric in the window, or 0 if there are none.
+*/
+double minimum(int metric);
+
+/**
+* Returns the mean of the samples of a metric in the window, or 0 if there are none.
+*/
+double mean(int metric);
+
+/**
+* Returns a percentile of the samples of a metric in the window, or 0 if there are none.
+* @param metric one of the metrics above
+* @param percent e.g. 99 for the 99th percentile
+*/
+double percentile(int metric, double percent);
+
+/**
+* Returns the largest sample of a metric in the window, or 0 if there are none.
+*/
+double maximum(int metric);
+
+/**
+* Removes all samples.
+*/
+void clear(void);
+
+friend ostream& operator<< (ostream & out, UpdateStats & stats);
+
+private:
+
+    int window;
+
+    // Ring of samples for each metric, and where the next one goes
+    vector<double> samples[NMETRICS];
+    int next[NMETRICS];
+
+    mutex lock;
+};
@@ -26,6 +26,9 @@ along with this code.  If not, see <http://www.gnu.org/licenses/>.
 #include "Scan.hpp"
 #include "PoseChange.hpp"
 #include "WheeledRobot.hpp"
+#include "ThreadPool.hpp"
+#include "UpdateStats.hpp"
+#include "Tracer.hpp"
 
 #include "algorithms.hpp"
 
@@ -38,6 +41,44 @@ static void Position2position_t(Position & cpp_pos, struct position_t * c_pos)
     c_pos->theta_degrees = cpp_pos.theta_degrees;
 }
 
+// Seeds chain k of a parallel search; chain 0 uses the seed itself
+static unsigned chain_seed(unsigned random_seed, int k)
+{
+    unsigned seed = random_seed + k * 0x9E3779B9U;
+    
+    // The generator gets stuck at zero
+    return seed ? seed : 1;
+}
+
+// Stages of update() are timed only if built with -DBREEZYSLAM_STATS
+#ifdef BREEZYSLAM_STATS
+#include <chrono>
+static double now_us(void)
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+#define STATS_START(start_us) double start_us = now_us()
+#define STATS_ADD(stats, metric, start_us) (stats)->add(UpdateStats::metric, now_us() - (start_us))
+#else
+#define STATS_START(start_us)
+#define STATS_ADD(stats, metric, start_us)
+#endif
+
+// Number of most recent updates kept by the statistics
+static const int STATS_WINDOW = 1000;
+
+// Adds the search counts from one update to the statistics
+static void add_search_stats(UpdateStats * stats, search_stats_t & search_stats)
+{
+#ifdef BREEZYSLAM_STATS
+    stats->add(UpdateStats::SEARCH_ITERATIONS, search_stats.iterations);
+    stats->add(UpdateStats::SEARCH_ACCEPTED, search_stats.accepted);
+    stats->add(UpdateStats::SEARCH_REJECTED, search_stats.rejected);
+    stats->add(UpdateStats::POINTS_SCORED, search_stats.points);
+    stats->add(UpdateStats::SEARCH_CACHE_HITS, search_stats.cache_hits);
+#endif
+}
+
 // CoreSLAM class -------------------------------------------------------------------------------------------------------
 
 int CoreSLAM::distanceScanToMap(
@@ -51,15 +92,68 @@ int CoreSLAM::distanceScanToMap(
    return distance_scan_to_map(map.map, scan.scan, pos_c);
 }
 
+vector<int> CoreSLAM::distanceScanToMap(
+    Scan & scan, 
+    Map & map,
+    vector<Position> & positions)
+{
+   vector<position_t> positions_c(positions.size());
+   for (unsigned k=0; k<positions.size(); ++k)
+   {
+       Position2position_t(positions[k], &positions_c[k]);
+   }
+   
+   vector<int> distances(positions.size());
+   if (!positions.empty())
+   {
+       distance_scan_to_map_batch(map.map, scan.scan, &positions_c[0], positions.size(), &distances[0]);
+   }
+   
+   return distances;
+}
+
+bool CoreSLAM::setKernel(const char * kernel_name)
+{
+    return distance_scan_to_map_select(kernel_name) == 0;
+}
+
+const char * CoreSLAM::getKernel(void)
+{
+    return distance_scan_to_map_kernel();
+}
+
 
 CoreSLAM::CoreSLAM(
     Laser & laser, 
     int map_size_pixels, 
     double map_size_meters)
+{
+    this->init(laser);
+    
+    // Initialize the map 
+    this->map = new Map(map_size_pixels, map_size_meters);
+    this->search_map = this->map;
+}
+
+CoreSLAM::CoreSLAM(
+    Laser & laser, 
+    const Map & map)
+{
+    this->init(laser);
+    
+    // Search the shared map, but never change it
+    this->map = NULL;
+    this->search_map = &map;
+}
+
+void CoreSLAM::init(Laser & laser)
 {
     // Set default params
     this->map_quality = DEFAULT_MAP_QUALITY;
     this->hole_width_mm = DEFAULT_HOLE_WIDTH_MM;   
+    this->map_update_threads = 1;
+    this->map_update_async = false;
+    this->map_update_worker = NULL;
     
     // Store laser for later
     this->laser = new Laser(laser);
@@ -70,25 +164,58 @@ CoreSLAM::CoreSLAM(
     // Initialize a scan for computing distance to map, and one for updating map
     this->scan_for_mapbuild = this->scan_create(3);
     this->scan_for_distance = this->scan_create(1);
+    this->scan_for_mapbuild_pending = this->scan_create(3);
     
-    // Initialize the map 
-    this->map = new Map(map_size_pixels, map_size_meters);
+    this->update_stats = new UpdateStats(STATS_WINDOW);
+    
+    this->tracer = NULL;
+    this->scan_count = 0;
 }
 
 CoreSLAM::~CoreSLAM(void)
 {        
+    this->stopTrace();
+    
+    delete this->map_update_worker;
+    
     delete this->map;
+    delete this->scan_for_mapbuild_pending;
     delete this->scan_for_distance;
     delete this->scan_for_mapbuild;
     delete this->poseChange;
+    delete this->update_stats;
 }
 
 
 void CoreSLAM::update(int * scan_mm, PoseChange & poseChange)
 {             
-    // Build a scan for computing distance to map, and one for updating map
-    this->scan_update(this->scan_for_mapbuild, scan_mm);
-    this->scan_update(this->scan_for_distance, scan_mm);
+    this->update(scan_mm, poseChange, NULL, this->laser->scan_size);
+}
+
+void CoreSLAM::update(int * scan_mm, PoseChange & poseChange, float * scan_angles_degrees, int scan_size)
+{             
+    TraceSpan update_span(this->tracer, "update", ++this->scan_count);
+    
+    STATS_START(update_start_us);
+    STATS_START(scan_start_us);
+    
+    // Build a scan for computing distance to map, and one for updating map, in one pass
+    {
+        TraceSpan scan_span(this->tracer, "scan_update", this->scan_count);
+        
+        scan_t * scans[2] = {this->scan_for_mapbuild->scan, this->scan_for_distance->scan};
+        scan_update_multiple(
+            scans,
+            2,
+            scan_angles_degrees,
+            scan_mm,
+            scan_size,
+            this->hole_width_mm,
+            this->poseChange->dxy_mm,
+            this->poseChange->dtheta_degrees);
+    }
+    
+    STATS_ADD(this->update_stats, SCAN_UPDATE, scan_start_us);
     
     // Update poseChange
     this->poseChange->update(poseChange.dxy_mm, 
@@ -97,6 +224,8 @@ void CoreSLAM::update(int * scan_mm, PoseChange & poseChange)
                              
     // Implementing class updates map and pointcloud
     this->updateMapAndPointcloud(poseChange);
+    
+    STATS_ADD(this->update_stats, UPDATE, update_start_us);
 }   
 
 void CoreSLAM::update(int * scan_mm) 
@@ -109,27 +238,137 @@ void CoreSLAM::update(int * scan_mm)
 
 void CoreSLAM::getmap(unsigned char * mapbytes)
 {
-    this->map->get((char *)mapbytes);
+    this->waitForMapUpdate();
+    
+    this->search_map->get((char *)mapbytes);
 }
 
-Scan * CoreSLAM::scan_create(int span)
+unsigned CoreSLAM::getmapTiles(unsigned since_version, int * tiles, unsigned char * mapbytes, int & ntiles)
 {
-    return new Scan(this->laser, span);
+    this->waitForMapUpdate();
+    
+    ntiles = this->search_map->getTiles(since_version, tiles, (char *)mapbytes);
+    
+    return this->search_map->getVersion();
 }
 
+int CoreSLAM::getmapTileCount(void)
+{
+    return this->search_map->tileCount();
+}
 
-void 
-CoreSLAM::scan_update(Scan * scan, int * scan_mm)
+void CoreSLAM::waitForMapUpdate(void)
 {
-    scan->update(scan_mm, this->hole_width_mm, *this->poseChange);
+    if (this->map_update_worker)
+    {
+        this->map_update_worker->wait();
+    }
+}
+
+bool CoreSLAM::useSparseMap(void)
+{
+    if (!this->map)
+    {
+        return false;
+    }
+    
+    this->waitForMapUpdate();
+    
+    int size_pixels = this->map->map->size_pixels;
+    double size_meters = this->map->map->size_meters;
+    
+    delete this->map;
+    this->map = new Map(size_pixels, size_meters, true);
+    this->search_map = this->map;
+    
+    return true;
 }
 
+bool CoreSLAM::saveMap(const char * filename)
+{
+    this->waitForMapUpdate();
+    
+    return this->search_map->save(filename);
+}
+
+bool CoreSLAM::openMap(const char * filename, int mode)
+{
+    if (!this->map)
+    {
+        return false;
+    }
+    
+    this->waitForMapUpdate();
+    
+    Map * map = Map::open(filename, mode);
+    
+    if (!map)
+    {
+        return false;
+    }
+    
+    delete this->map;
+    this->map = map;
+    this->search_map = map;
+    
+    return true;
+}
+
+UpdateStats & CoreSLAM::getUpdateStats(void)
+{
+    return *this->update_stats;
+}
+
+bool CoreSLAM::startTrace(const char * filename)
+{
+    this->stopTrace();
+    
+    this->tracer = Tracer::open(filename);
+    
+    return this->tracer != NULL;
+}
+
+bool CoreSLAM::stopTrace(void)
+{
+    // Every span must be recorded before the trace is written
+    this->waitForMapUpdate();
+    
+    if (!this->tracer)
+    {
+        return true;
+    }
+    
+    bool written = this->tracer->close();
+    
+    delete this->tracer;
+    this->tracer = NULL;
+    
+    return written;
+}
+
+bool CoreSLAM::isLocalizationOnly(void)
+{
+    return this->map == NULL;
+}
+
+Scan * CoreSLAM::scan_create(int span)
+{
+    return new Scan(this->laser, span);
+}
+
+
 SinglePositionSLAM::SinglePositionSLAM(Laser & laser, int map_size_pixels, double map_size_meters) :
 CoreSLAM(laser, map_size_pixels, map_size_meters)
 {
     this->position = Position(this->init_coord_mm(), this->init_coord_mm(), 0);
 }
 
+SinglePositionSLAM::SinglePositionSLAM(Laser & laser, const Map & map) :
+CoreSLAM(laser, map)
+{
+    this->position = Position(this->init_coord_mm(), this->init_coord_mm(), 0);
+}
+
     
 // SinglePositionSLAM class -------------------------------------------------------------------------------------------
 
@@ -147,11 +386,54 @@ void SinglePositionSLAM::updateMapAndPointcloud(PoseChange & poseChange)
     start_pos.x_mm += this->laser->offset_mm * this->costheta();
     start_pos.y_mm += this->laser->offset_mm * this->sintheta();
     
+    // Search the map with every earlier scan in it
+    this->waitForMapUpdate();
+    
     // Get new position from implementing class
-    Position new_position = this->getNewPosition(start_pos);
+    STATS_START(search_start_us);
+    Position new_position;
+    {
+        TraceSpan search_span(this->tracer, "position_search", this->scan_count);
+        new_position = this->getNewPosition(start_pos);
+    }
+    STATS_ADD(this->update_stats, POSITION_SEARCH, search_start_us);
          
-    // Update the map with this new position
-    this->map->update(*this->scan_for_mapbuild, new_position, this->map_quality, this->hole_width_mm);
+    // Update the map with this new position, unless it is shared
+    if (this->map)
+    {
+        this->map->setUpdateThreads(this->map_update_threads);
+        if (this->map_update_async)
+        {
+            // Integrate this scan in the background, and build the next one in the other buffer
+            swap(this->scan_for_mapbuild, this->scan_for_mapbuild_pending);
+            
+            Scan * scan = this->scan_for_mapbuild_pending;
+            int quality = this->map_quality;
+            double hole_width_mm = this->hole_width_mm;
+            int scan_count = this->scan_count;
+            
+            if (!this->map_update_worker)
+            {
+                // One worker thread besides this one
+                this->map_update_worker = new ThreadPool(2);
+            }
+            
+            this->map_update_worker->start(1, [this, scan, new_position, quality, hole_width_mm, scan_count](int) mutable
+            {
+                TraceSpan map_span(this->tracer, "map_update", scan_count);
+                STATS_START(map_start_us);
+                this->map->update(*scan, new_position, quality, hole_width_mm);
+                STATS_ADD(this->update_stats, MAP_UPDATE, map_start_us);
+            });
+        }
+        else
+        {
+            TraceSpan map_span(this->tracer, "map_update", this->scan_count);
+            STATS_START(map_start_us);
+            this->map->update(*this->scan_for_mapbuild, new_position, this->map_quality, this->hole_width_mm);
+            STATS_ADD(this->update_stats, MAP_UPDATE, map_start_us);
+        }
+    }
    
     // Update the current position with this new position, adjusted by laser offset
     this->position = Position(new_position);
@@ -167,7 +449,7 @@ Position & SinglePositionSLAM::getpos(void)
 double SinglePositionSLAM::init_coord_mm(void)
 {
     // Center of map
-    return 500 * this->map->map->size_meters;
+    return 500 * this->search_map->map->size_meters;
 }
 
 
@@ -192,37 +474,155 @@ double SinglePositionSLAM::sintheta(void)
 RMHC_SLAM::RMHC_SLAM(Laser & laser, int map_size_pixels, double map_size_meters, unsigned random_seed) :
 SinglePositionSLAM(laser, map_size_pixels, map_size_meters)
 {    
+    this->init_search(random_seed);
+}
+
+RMHC_SLAM::RMHC_SLAM(Laser & laser, const Map & map, unsigned random_seed) :
+SinglePositionSLAM(laser, map)
+{    
+    this->init_search(random_seed);
+}
+
+void RMHC_SLAM::init_search(unsigned random_seed)
+{
     this->sigma_xy_mm = DEFAULT_SIGMA_XY_MM;
     this->sigma_theta_degrees = DEFAULT_SIGMA_THETA_DEGREES;
     
     this->max_search_iter = DEFAULT_MAX_SEARCH_ITER;
     
+    this->search_threads = 1;
+    
+    this->pyramid_levels = 0;
+    
+    this->cache_search_scores = false;
+    this->cache_rotated_scans = false;
+    
     this->randomizer = random_new(random_seed);
+    this->random_seed = random_seed;
+    
+    this->search_pool = NULL;
 }
 
 RMHC_SLAM::~RMHC_SLAM(void)
 {
+    this->freeSearchThreads();
+    
     free(this->randomizer);
 }
 
+void RMHC_SLAM::initSearchThreads(void)
+{
+    this->freeSearchThreads();
+    
+    this->search_pool = new ThreadPool(this->search_threads);
+    
+    for (int k=1; k<this->search_threads; ++k)
+    {
+        this->chain_randomizers.push_back(random_new(chain_seed(this->random_seed, k)));
+    }
+}
+
+void RMHC_SLAM::freeSearchThreads(void)
+{
+    delete this->search_pool;
+    this->search_pool = NULL;
+    
+    for (unsigned k=0; k<this->chain_randomizers.size(); ++k)
+    {
+        random_free(this->chain_randomizers[k]);
+    }
+    this->chain_randomizers.clear();
+}
+
 Position RMHC_SLAM::getNewPosition(Position & start_pos)
 {
     // Search for a new position if indicated
     Position likeliest_position = start_pos;
     if (this->randomizer)
     {
+        // Keep map pyramid in sync with requested coarse-to-fine levels; a shared map keeps its own
+        if (this->map)
+        {
+            this->map->setPyramidLevels(this->pyramid_levels);
+        }
+        
         // Use C to find likeliest position
         position_t start_pos_c;
         Position2position_t(start_pos, &start_pos_c);
-        position_t c_likeliest_position = 
-        rmhc_position_search(
-            start_pos_c,
-            this->map->map,
-            this->scan_for_distance->scan,
-            this->sigma_xy_mm,
-            this->sigma_theta_degrees,
-            this->max_search_iter,
-            this->randomizer);    
+        position_t c_likeliest_position;
+        
+        if (this->search_threads > 1)
+        {
+            if (!this->search_pool || this->search_pool->size() != this->search_threads)
+            {
+                this->initSearchThreads();
+            }
+            
+            // Split the iteration budget among the chains
+            int nchains = this->search_threads;
+            int chain_iter = this->max_search_iter / nchains;
+            if (chain_iter == 0 && this->max_search_iter > 0)
+            {
+                chain_iter = 1;
+            }
+            
+            vector<position_t> chain_positions(nchains);
+            vector<int> chain_distances(nchains);
+            vector<search_stats_t> chain_stats(nchains);
+            
+            this->search_pool->run(nchains, [&](int k) 
+            {
+                TraceSpan chain_span(this->tracer, "search_chain", this->scan_count);
+                
+                // Start counting afresh on this thread
+                search_stats_take(&chain_stats[k]);
+                
+                chain_positions[k] = 
+                this->search(start_pos_c, chain_iter, k ? this->chain_randomizers[k-1] : this->randomizer);
+                
+                chain_distances[k] = 
+                distance_scan_to_map(this->search_map->map, this->scan_for_distance->scan, chain_positions[k]);
+                
+                search_stats_take(&chain_stats[k]);
+            });
+            
+            search_stats_t search_stats = chain_stats[0];
+            for (int k=1; k<nchains; ++k)
+            {
+                search_stats.iterations += chain_stats[k].iterations;
+                search_stats.accepted += chain_stats[k].accepted;
+                search_stats.rejected += chain_stats[k].rejected;
+                search_stats.points += chain_stats[k].points;
+                search_stats.cache_hits += chain_stats[k].cache_hits;
+            }
+            
+            add_search_stats(this->update_stats, search_stats);
+            
+            // Keep the best chain, breaking ties by chain number so results are reproducible
+            int best = 0;
+            for (int k=1; k<nchains; ++k)
+            {
+                // -1 indicates infinity
+                if (chain_distances[k] > -1 && 
+                    (chain_distances[best] == -1 || chain_distances[k] < chain_distances[best]))
+                {
+                    best = k;
+                }
+            }
+            
+            c_likeliest_position = chain_positions[best];
+        }
+        
+        else
+        {
+            search_stats_t search_stats;
+            search_stats_take(&search_stats);
+            
+            c_likeliest_position = this->search(start_pos_c, this->max_search_iter, this->randomizer);
+            
+            search_stats_take(&search_stats);
+            add_search_stats(this->update_stats, search_stats);
+        }
         
         // Convert back to C++ object
         likeliest_position = 
@@ -235,6 +635,86 @@ Position RMHC_SLAM::getNewPosition(Position & start_pos)
     return likeliest_position;
 }
 
+position_t RMHC_SLAM::search(position_t start_pos, int max_search_iter, void * randomizer)
+{
+    int options = 
+        (this->cache_search_scores ? RMHC_SEARCH_CACHE_SCORES : RMHC_SEARCH_EXACT) |
+        (this->cache_rotated_scans ? RMHC_SEARCH_ROTATED_BINS : RMHC_SEARCH_EXACT);
+    
+    if (this->pyramid_levels > 0)
+    {
+        return rmhc_position_search_coarse_to_fine(
+            start_pos,
+            this->search_map->map,
+            this->scan_for_distance->scan,
+            this->sigma_xy_mm,
+            this->sigma_theta_degrees,
+            max_search_iter,
+            randomizer,
+            options);
+    }
+    
+    return rmhc_position_search_ex(
+        start_pos,
+        this->search_map->map,
+        this->scan_for_distance->scan,
+        this->sigma_xy_mm,
+        this->sigma_theta_degrees,
+        max_search_iter,
+        randomizer,
+        options);    
+}
+
+// BranchAndBound_SLAM class ---------------------------------------------------------------------------------------------
+
+BranchAndBound_SLAM::BranchAndBound_SLAM(Laser & laser, int map_size_pixels, double map_size_meters) :
+SinglePositionSLAM(laser, map_size_pixels, map_size_meters)
+{
+    this->init_search();
+}
+
+BranchAndBound_SLAM::BranchAndBound_SLAM(Laser & laser, const Map & map) :
+SinglePositionSLAM(laser, map)
+{
+    this->init_search();
+}
+
+void BranchAndBound_SLAM::init_search(void)
+{
+    this->window_xy_mm = DEFAULT_WINDOW_XY_MM;
+    this->window_theta_degrees = DEFAULT_WINDOW_THETA_DEGREES;
+    this->theta_step_degrees = DEFAULT_THETA_STEP_DEGREES;
+    
+    this->bound_levels = DEFAULT_BOUND_LEVELS;
+}
+
+Position BranchAndBound_SLAM::getNewPosition(Position & start_pos)
+{
+    // Keep map pyramid in sync with requested bound levels; a shared map keeps its own
+    if (this->map)
+    {
+        this->map->setPyramidLevels(this->bound_levels);
+    }
+    
+    // Use C to find best position
+    position_t start_pos_c;
+    Position2position_t(start_pos, &start_pos_c);
+    position_t c_best_position = 
+    bnb_position_search(
+        start_pos_c,
+        this->search_map->map,
+        this->scan_for_distance->scan,
+        this->window_xy_mm,
+        this->window_theta_degrees,
+        this->theta_step_degrees);
+    
+    // Convert back to C++ object
+    return Position(
+        c_best_position.x_mm, 
+        c_best_position.y_mm, 
+        c_best_position.theta_degrees); 
+}
+
 // DeterministicSLAM class ---------------------------------------------------------------------------------------------
 
 Deterministic_SLAM::Deterministic_SLAM(Laser & laser, int map_size_pixels, double map_size_meters) :
@@ -29,6 +29,9 @@ class Position;
 class Map;
 class Scan;
 class Laser;
+class ThreadPool;
+class UpdateStats;
+class Tracer;
 
 /**
 *    CoreSLAM is an abstract class that uses the classes Position, Map, Scan, and Laser
@@ -66,12 +69,112 @@ public:
     */
     static int distanceScanToMap(Scan & scan, Map & map, Position & position);
     
+    /**
+    * Computes distances between a scan and map for several hypothetical positions at once, 
+    * which is faster than calling distanceScanToMap() for each position.
+    * @param scan the scan
+    * @param map the map
+    * @param positions the positions
+    * @return distance for each position in arbitrary units, or -1 for infinity
+    */
+    static vector<int> distanceScanToMap(Scan & scan, Map & map, vector<Position> & positions);
+    
+    /**
+    * Forces distanceScanToMap() and position search to use the named SIMD kernel, e.g. for 
+    * benchmarking.  By default the fastest kernel supported by the CPU is used, unless
+    * overridden by the BREEZYSLAM_KERNEL environment variable.
+    * @param kernel_name one of "sisd", "sse", "avx2", "avx512", "neon"
+    * @return true on success, false if the kernel is not available on this machine
+    */
+    static bool setKernel(const char * kernel_name);
+    
+    /**
+    * Returns the name of the SIMD kernel used by distanceScanToMap().
+    * @return the kernel name
+    */
+    static const char * getKernel(void);
+    
     /**
     * Retrieves the current map.
     * @param mapbytes a byte array big enough to hold the map (map_size_pixels * map_size_pixels)
     */
     void getmap(unsigned char * mapbytes);
     
+    /**
+    * Retrieves the parts of the current map changed since an earlier version; see Map::getTiles().
+    * @param since_version the value returned by the last call, or 0 for the whole map
+    * @param tiles receives the index of each changed tile; should hold getmapTileCount() values
+    * @param mapbytes receives the pixels of each changed tile; should hold getmapTileCount() tiles
+    * @param ntiles receives the number of changed tiles
+    * @return the current map version, to pass next time
+    */
+    unsigned getmapTiles(unsigned since_version, int * tiles, unsigned char * mapbytes, int & ntiles);
+    
+    /**
+    * Returns the number of tiles in the map, for sizing the arrays passed to getmapTiles().
+    */
+    int getmapTileCount(void);
+    
+    /**
+    * Waits for a map update started in the background (see <tt>map_update_async</tt>) to finish.
+    * Call before reading the <tt>map</tt> member directly; getmap() calls it for you.
+    */
+    void waitForMapUpdate(void);
+    
+    /**
+    * Replaces the map with an empty sparse map of the same size, whose memory grows with the 
+    * area explored; see Map::Map().  Call before the first update().
+    * @return true on success, false if this object only localizes against a shared map, which is
+    * then unchanged
+    */
+    bool useSparseMap(void);
+    
+    /**
+    * Saves the current map to a file; see Map::save().
+    * @param filename name of the file
+    * @return true on success, false on failure
+    */
+    bool saveMap(const char * filename);
+    
+    /**
+    * Replaces the current map with one from a file saved by saveMap(), e.g. to resume in a known 
+    * place; see Map::open().  The current position is unchanged.
+    * @param filename name of the file
+    * @param mode Map::OPEN_COPY, Map::OPEN_READ_ONLY, or Map::OPEN_COPY_ON_WRITE
+    * @return true on success, false if the file cannot be opened as a map or this object only 
+    * localizes against a shared map (the map is then unchanged)
+    */
+    bool openMap(const char * filename, int mode);
+    
+    /**
+    * Returns rolling statistics of the time taken by each stage of update() and of the work done 
+    * by RMHC search, over the most recent 1000 updates; see UpdateStats.  These are gathered only 
+    * if the library is built with -DBREEZYSLAM_STATS.
+    */
+    UpdateStats & getUpdateStats(void);
+    
+    /**
+    * Starts recording a timeline of update() in Chrome trace-event format, for viewing in 
+    * chrome://tracing or https://ui.perfetto.dev: a span for each update, scan build, position search, 
+    * search chain, and map update, tagged with the number of the scan and the thread that did the work.
+    * Any earlier trace is stopped first.  Recording adds little time to update().
+    * @param filename name of the file to write, conventionally ending in .json
+    * @return true on success, false if the file cannot be created
+    */
+    bool startTrace(const char * filename);
+    
+    /**
+    * Stops recording, and writes the rest of the trace file.  Called by the destructor if needed.
+    * @return true on success, false on failure to write the file
+    */
+    bool stopTrace(void);
+    
+    /**
+    * Returns true if this object was created with a shared map, which update() uses to find the 
+    * position but never changes.
+    */
+    bool isLocalizationOnly(void);
+    
    /**
     * Updates the scan and odometry, and calls the the implementing class's updateMapAndPointcloud method with
     * the specified poseChange.
@@ -82,6 +185,18 @@ public:
     */
     void update(int * scan_mm, PoseChange & poseChange);
 
+    /**
+    * Updates the scan and odometry from a Lidar scan taken at arbitrary angles, and calls the the 
+    * implementing class's updateMapAndPointcloud method with the specified poseChange.
+    * 
+    * @param scan_mm Lidar scan values
+    * @param poseChange poseChange for odometry
+    * @param scan_angles_degrees angle of each scan value, in any order
+    * @param scan_size number of scan values (at most the <tt>scan_size</tt> attribute of the
+    * Laser object passed to the CoreSlam constructor)
+    */
+    void update(int * scan_mm, PoseChange & poseChange, float * scan_angles_degrees, int scan_size);
+
 
     /**
     * Updates the scan, and calls the the implementing class's updateMapAndPointcloud method with zero poseChange
@@ -102,6 +217,19 @@ public:
     */
     double hole_width_mm;
 
+    /**
+    * The number of threads used to update the map after each scan; default = 1.
+    * The map is the same for any number of threads.
+    */
+    int map_update_threads;
+
+    /**
+    * If true, update() returns as soon as the new position is found, and the map is updated 
+    * on a background thread; the next update() waits for it before searching, so every search 
+    * sees the map with all earlier scans.  Default = false.
+    */
+    bool map_update_async;
+
 protected:
 
     /**
@@ -113,16 +241,33 @@ protected:
     */
     CoreSLAM(Laser & laser, int map_size_pixels, double map_size_meters);
 
+    /**
+    * Creates a CoreSLAM object that only localizes against an existing map, which it never changes
+    * and does not own.  Any number of such objects can share one map from different threads, as long 
+    * as nothing else updates the map meanwhile.  Searches use the pyramid levels the map already has 
+    * (see Map::setPyramidLevels()).
+    * @param laser a Laser object containing parameters for your Lidar equipment
+    * @param map the shared map, which must outlive this object
+    * @return a new CoreSLAM object
+    */
+    CoreSLAM(Laser & laser, const Map & map);
+
     /**
     * Deallocates this CoreSLAM object.
     */
     ~CoreSLAM(void);
 
      /**
-     * A pointer to the current map
+     * A pointer to the current map, which this object owns and updates; NULL if it only localizes
+     * against a shared map
      */
     Map * map;
     
+    /**
+    * The map searched for the position, which searches only read: <tt>map</tt>, or the shared map
+    */
+    const Map * search_map;
+    
     /**
     * A pointer to the laser model
     */
@@ -138,10 +283,37 @@ protected:
     */
     Scan * scan_for_distance;    
     
+    /**
+    * The scan being integrated into the map in the background, while the next one is built
+    * in <tt>scan_for_mapbuild</tt>
+    */
+    Scan * scan_for_mapbuild_pending;
+    
+    /**
+    * Runs the background map update on one thread kept for the life of this object; NULL until
+    * the first background update
+    */
+    ThreadPool * map_update_worker;
+    
     /**
     * The current poseChange from odometry
     */
     class PoseChange * poseChange;
+    
+    /**
+    * Statistics of recent updates
+    */
+    UpdateStats * update_stats;
+    
+    /**
+    * Records spans of work while tracing, otherwise NULL
+    */
+    Tracer * tracer;
+    
+    /**
+    * The number of scans passed to update() so far, which numbers the spans traced
+    */
+    int scan_count;
         
     /**
     * Updates the map and point-cloud (particle cloud). Called automatically by CoreSLAM::update()
@@ -151,9 +323,9 @@ protected:
 
 private:
             
-    Scan * scan_create(int span);
+    void init(Laser & laser);
     
-    void scan_update(Scan * scan, int * scan_mm);
+    Scan * scan_create(int span);
    
 }; // CoreSLAM
 
@@ -188,6 +360,14 @@ protected:
     */
     SinglePositionSLAM(Laser & laser, int map_size_pixels, double map_size_meters);
     
+    /**
+    * Creates a SinglePositionSLAM object that only localizes against a shared map; see CoreSLAM::CoreSLAM().
+    * @param laser a Laser object containing parameters for your Lidar equipment
+    * @param map the shared map, which must outlive this object
+    * @return a new SinglePositionSLAM object
+    */
+    SinglePositionSLAM(Laser & laser, const Map & map);
+    
     
     /**
     * Updates the map and point-cloud (particle cloud). Called automatically by CoreSLAM::update()
@@ -238,6 +418,19 @@ public:
         double map_size_meters, 
         unsigned random_seed);
 
+    /**
+    * Creates an RMHC_SLAM object that only localizes against a shared map, which it never changes, 
+    * so that many robots or replays can be tracked in one map from different threads without 
+    * copying it.  Build the map's pyramid first if using <tt>pyramid_levels</tt>.
+    * @param laser a Laser object containing parameters for your Lidar equipment
+    * @param map the shared map, which must outlive this object
+    * @param random_seed seed for psuedorandom number generator in particle filter
+    * @return a new RMHC_SLAM object
+    */
+    RMHC_SLAM(Laser & laser, 
+        const Map & map,
+        unsigned random_seed);
+
     ~RMHC_SLAM(void);    
     
    
@@ -254,10 +447,44 @@ public:
     double sigma_theta_degrees;   
 
     /**
-    * The maximum number of iterations for particle-filter search; default = 1000
+    * The maximum number of iterations for particle-filter search; default = 1000.
+    * With several search threads, this budget is shared evenly among their chains.
     */
     int max_search_iter;   
 
+    /**
+    * The number of independent hill-climbing chains to run in parallel, each on its
+    * own thread with its own pseudorandom-number stream derived from the random seed.
+    * The position with the lowest distance wins.  Results are reproducible for a given
+    * seed and thread count; default = 1 (sequential search)
+    */
+    int search_threads;
+
+    /**
+    * The number of coarser map resolutions (1/2, 1/4, ...) to search before searching
+    * at full resolution, halving the sigmas at each finer level.  The iteration budget 
+    * is split evenly among the levels; default = 0 (full resolution only).  A shared map is never 
+    * changed, so any nonzero value searches the levels it already has (see Map::setPyramidLevels())
+    */
+    int pyramid_levels;
+
+    /**
+    * If true, a candidate position that rounds to a map pixel and angle bin already scored at the 
+    * same search level gets the earlier score instead of being scored again.  The bins are small 
+    * enough that no scan point moves more than half a pixel within one, but the search then 
+    * follows a different path and finds slightly different positions.  Default = false.
+    */
+    bool cache_search_scores;
+
+    /**
+    * If true, once the angle sigma is small, candidate positions are scored at the center of 
+    * their angle bin (as above), from scan points rotated once per bin and scan, shared by all 
+    * search threads and pyramid levels.  This saves most with the sisd, sse, and neon kernels 
+    * (see setKernel()); like <tt>cache_search_scores</tt>, it changes the positions found.  
+    * Default = false.
+    */
+    bool cache_rotated_scans;
+
 protected:
 
     /**
@@ -269,11 +496,92 @@ protected:
 
 private:
 
+    void init_search(unsigned random_seed);
+    
     // Pseudorandom-number generator
     void * randomizer;
+    
+    unsigned random_seed;
+    
+    // Support for parallel search: one generator per chain after the first
+    ThreadPool * search_pool;
+    vector<void *> chain_randomizers;
+    
+    void initSearchThreads(void);
+    
+    void freeSearchThreads(void);
+    
+    struct position_t search(struct position_t start_pos, int max_search_iter, void * randomizer);
    
 }; // RMHC_SLAM
 
+/**
+*    BranchAndBound_SLAM implements SinglePositionSLAM using an exhaustive branch-and-bound search 
+*    of a window around the starting position.  Blocks of candidate positions are pruned using
+*    lower bounds from coarser copies of the map, so the result is the best position in the 
+*    window (to the nearest map pixel and rotation step) and the worst-case search time is 
+*    fixed by the window size.
+*/
+class BranchAndBound_SLAM : public SinglePositionSLAM
+{
+
+public:
+
+    /**
+    * Creates a BranchAndBound_SLAM object.
+    * @param laser a Laser object containing parameters for your Lidar equipment
+    * @param map_size_pixels the size of the desired map (map is square)
+    * @param map_size_meters the size of the area to be mapped, in meters
+    * @return a new BranchAndBound_SLAM object
+    */
+    BranchAndBound_SLAM(Laser & laser, int map_size_pixels, double map_size_meters);
+    
+    /**
+    * Creates a BranchAndBound_SLAM object that only localizes against a shared map, which it never
+    * changes.  The search bounds come from the pyramid levels the map already has, so call 
+    * Map::setPyramidLevels() on it first.
+    * @param laser a Laser object containing parameters for your Lidar equipment
+    * @param map the shared map, which must outlive this object
+    * @return a new BranchAndBound_SLAM object
+    */
+    BranchAndBound_SLAM(Laser & laser, const Map & map);
+    
+    /**
+    * The half-width in millimeters of the (X,Y) search window; default = 200
+    */
+    double window_xy_mm;
+
+    /**
+    * The half-width in degrees of the angular search window; default = 10
+    */
+    double window_theta_degrees;
+    
+    /**
+    * The step in degrees between rotations searched; default = 1
+    */
+    double theta_step_degrees;
+    
+    /**
+    * The number of coarser map resolutions (1/2, 1/4, ...) used for bounds; default = 2.  Ignored
+    * for a shared map, whose own levels are used (see Map::setPyramidLevels())
+    */
+    int bound_levels;
+
+protected:
+
+    /**
+    * Returns a new position based on branch-and-bound search around a starting position. 
+    * Called automatically by SinglePositionSLAM::updateMapAndPointcloud()
+    * @param start_position the starting position
+    */
+    Position getNewPosition(Position & start_position);
+    
+private:
+
+    void init_search(void);
+    
+}; // BranchAndBound_SLAM
+
 /**
 *    Deterministic_SLAM implements SinglePositionSLAM using by returning the starting position instead of searching
 *    on it; i.e., using odometry alone.
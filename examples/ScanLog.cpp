@@ -0,0 +1,268 @@
+/**
+*
+* ScanLog.cpp - C++ code for binary logs of Lidar scans and odometry
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "Laser.hpp"
+#include "ScanLog.hpp"
+
+uint32_t scanlog_record_bytes(int scan_size, int range_bytes)
+{
+    uint32_t bytes = sizeof(int64_t) + 2*sizeof(int32_t) + scan_size * range_bytes;
+
+    return (bytes + 7) & ~7;
+}
+
+static bool little_endian(void)
+{
+    uint16_t one = 1;
+
+    return *(char *)&one == 1;
+}
+
+void scanlog_byte_order(void * values, int value_bytes, int count)
+{
+    if (little_endian())
+    {
+        return;
+    }
+
+    char * bytes = (char *)values;
+
+    for (int k=0; k<count; ++k, bytes += value_bytes)
+    {
+        for (int j=0; j<value_bytes/2; ++j)
+        {
+            char byte = bytes[j];
+            bytes[j] = bytes[value_bytes-1-j];
+            bytes[value_bytes-1-j] = byte;
+        }
+    }
+}
+
+void scanlog_header_byte_order(scanlog_header_t * header)
+{
+    scanlog_byte_order(&header->format_version, sizeof(uint32_t), 1);
+    scanlog_byte_order(&header->header_bytes, sizeof(uint32_t), 1);
+    scanlog_byte_order(&header->record_bytes, sizeof(uint32_t), 1);
+    scanlog_byte_order(&header->range_bytes, sizeof(uint32_t), 1);
+    scanlog_byte_order(&header->nrecords, sizeof(uint64_t), 1);
+    scanlog_byte_order(&header->scan_size, sizeof(int32_t), 1);
+    scanlog_byte_order(&header->detection_margin, sizeof(int32_t), 1);
+    scanlog_byte_order(&header->scan_rate_hz, sizeof(double), 1);
+    scanlog_byte_order(&header->detection_angle_degrees, sizeof(double), 1);
+    scanlog_byte_order(&header->distance_no_detection_mm, sizeof(double), 1);
+    scanlog_byte_order(&header->offset_mm, sizeof(double), 1);
+}
+
+ScanLog::ScanLog(void)
+{
+    memset(&this->header, 0, sizeof(this->header));
+    this->records = NULL;
+    this->data = NULL;
+    this->data_bytes = 0;
+    this->mapped = false;
+}
+
+static bool bad_header(const scanlog_header_t * header, size_t file_bytes)
+{
+    return
+        memcmp(header->magic, SCANLOG_MAGIC, sizeof(SCANLOG_MAGIC)) ||
+        header->format_version != SCANLOG_VERSION ||
+        header->header_bytes < sizeof(scanlog_header_t) ||
+        header->header_bytes % 8 ||
+        header->header_bytes > file_bytes ||
+        (header->range_bytes != 2 && header->range_bytes != 4) ||
+        header->scan_size <= 0 ||
+        header->record_bytes != scanlog_record_bytes(header->scan_size, header->range_bytes) ||
+        header->nrecords > (file_bytes - header->header_bytes) / header->record_bytes;
+}
+
+ScanLog * ScanLog::open(const char * filename)
+{
+    ScanLog * log = new ScanLog();
+
+#ifndef _WIN32
+    int fd = ::open(filename, O_RDONLY);
+
+    if (fd < 0)
+    {
+        delete log;
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        // Private, so that changing a scan in place cannot change the file
+        void * data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            log->data = data;
+            log->data_bytes = st.st_size;
+            log->mapped = true;
+        }
+    }
+
+    close(fd);
+#else
+    FILE * fp = fopen(filename, "rb");
+
+    if (fp)
+    {
+        fseek(fp, 0, SEEK_END);
+        long bytes = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+
+        log->data = bytes > 0 ? malloc(bytes) : NULL;
+
+        if (log->data && fread(log->data, 1, bytes, fp) == (size_t)bytes)
+        {
+            log->data_bytes = bytes;
+        }
+
+        fclose(fp);
+    }
+#endif
+
+    if (!log->data_bytes)
+    {
+        delete log;
+        return NULL;
+    }
+
+    // A file too short for the header leaves it zeroed, with no magic
+    if (log->data_bytes >= sizeof(scanlog_header_t))
+    {
+        memcpy(&log->header, log->data, sizeof(scanlog_header_t));
+        scanlog_header_byte_order(&log->header);
+    }
+
+    if (bad_header(&log->header, log->data_bytes))
+    {
+        fprintf(stderr, "ScanLog::open: %s is not a valid scan log\n", filename);
+        delete log;
+        return NULL;
+    }
+
+    log->records = (char *)log->data + log->header.header_bytes;
+
+    return log;
+}
+
+ScanLog::~ScanLog(void)
+{
+#ifndef _WIN32
+    if (this->mapped)
+    {
+        munmap(this->data, this->data_bytes);
+        return;
+    }
+#endif
+
+    free(this->data);
+}
+
+int ScanLog::size(void)
+{
+    return (int)this->header.nrecords;
+}
+
+int ScanLog::getScanSize(void)
+{
+    return this->header.scan_size;
+}
+
+Laser ScanLog::getLaser(void)
+{
+    return Laser(
+        this->header.scan_size,
+        this->header.scan_rate_hz,
+        this->header.detection_angle_degrees,
+        this->header.distance_no_detection_mm,
+        this->header.detection_margin,
+        this->header.offset_mm);
+}
+
+void ScanLog::getOdometry(int k, long * odometry)
+{
+    const char * record = this->records + (size_t)k * this->header.record_bytes;
+
+    int64_t timestamp_usec;
+    int32_t wheels[2];
+    memcpy(&timestamp_usec, record, sizeof(timestamp_usec));
+    memcpy(wheels, record + sizeof(timestamp_usec), sizeof(wheels));
+
+    scanlog_byte_order(&timestamp_usec, sizeof(timestamp_usec), 1);
+    scanlog_byte_order(wheels, sizeof(int32_t), 2);
+
+    odometry[0] = (long)timestamp_usec;
+    odometry[1] = wheels[0];
+    odometry[2] = wheels[1];
+}
+
+int * ScanLog::getScan(int k, int * scan_mm)
+{
+    char * ranges = this->records + (size_t)k * this->header.record_bytes + sizeof(int64_t) + 2*sizeof(int32_t);
+
+    if (this->header.range_bytes == sizeof(int))
+    {
+        // Records and the header are padded to eight bytes, so 32-bit ranges are aligned
+        if (little_endian())
+        {
+            return (int *)ranges;
+        }
+
+        memcpy(scan_mm, ranges, this->header.scan_size * sizeof(int));
+        scanlog_byte_order(scan_mm, sizeof(int), this->header.scan_size);
+
+        return scan_mm;
+    }
+
+    uint16_t * ranges16 = (uint16_t *)ranges;
+
+    if (little_endian())
+    {
+        for (int j=0; j<this->header.scan_size; ++j)
+        {
+            scan_mm[j] = ranges16[j];
+        }
+    }
+    else
+    {
+        for (int j=0; j<this->header.scan_size; ++j)
+        {
+            scan_mm[j] = (uint16_t)(ranges16[j] << 8 | ranges16[j] >> 8);
+        }
+    }
+
+    return scan_mm;
+}
@@ -0,0 +1,145 @@
+/**
+*
+* ScanLog.hpp - header for binary logs of Lidar scans and odometry
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Laser;
+
+/**
+* The header at the start of a binary scan log, padded to SCANLOG_HEADER_BYTES.  The records
+* follow it, each record_bytes long:
+* <pre>
+*    int64_t timestamp_usec
+*    int32_t odometry[2]            (left and right wheel)
+*    range_t ranges[scan_size]      (millimeters; uint16_t or int32_t, as given by range_bytes)
+* </pre>
+* padded with zeros to a multiple of eight bytes.  All values are little-endian, and header_bytes is
+* a multiple of eight, so that the ranges are aligned.
+*/
+typedef struct scanlog_header_t
+{
+    char magic[8];
+    uint32_t format_version;
+    uint32_t header_bytes;
+    uint32_t record_bytes;
+    uint32_t range_bytes;
+    uint64_t nrecords;
+
+    // Laser parameters
+    int32_t scan_size;
+    int32_t detection_margin;
+    double scan_rate_hz;
+    double detection_angle_degrees;
+    double distance_no_detection_mm;
+    double offset_mm;
+
+} scanlog_header_t;
+
+static const char     SCANLOG_MAGIC[8]      = "BZSLLOG";
+static const uint32_t SCANLOG_VERSION       = 1;
+static const uint32_t SCANLOG_HEADER_BYTES  = 4096;
+
+/**
+* Returns the length of each record in a log of scans of the given size.
+* @param scan_size number of ranges per scan
+* @param range_bytes 2 or 4
+*/
+uint32_t scanlog_record_bytes(int scan_size, int range_bytes);
+
+/**
+* Converts values between little-endian, as in a log, and the byte order of this host, in place;
+* does nothing on a little-endian host.
+* @param values the values
+* @param value_bytes the size of each value: 2, 4, or 8
+* @param count the number of values
+*/
+void scanlog_byte_order(void * values, int value_bytes, int count);
+
+/**
+* Converts each field of a header between little-endian and the byte order of this host, in place.
+*/
+void scanlog_header_byte_order(scanlog_header_t * header);
+
+/**
+* A binary log of Lidar scans and odometry, mapped into memory rather than read, so that
+* opening a log takes no time however long it is, and only the pages of the scans used are
+* ever loaded.
+*/
+class ScanLog
+{
+public:
+
+/**
+* Opens a log written by dat2log.  Reports on stderr a file that is not a valid scan log.
+* @param filename name of the file
+* @return a new ScanLog object, or NULL if the file cannot be opened as a scan log
+*/
+static ScanLog * open(const char * filename);
+
+/**
+* Closes this log.
+*/
+~ScanLog(void);
+
+/**
+* Returns the number of scans in this log.
+*/
+int size(void);
+
+/**
+* Returns a Laser object with the parameters of the Lidar that made this log.
+*/
+Laser getLaser(void);
+
+/**
+* Returns the number of ranges in each scan.
+*/
+int getScanSize(void);
+
+/**
+* Gets the odometry of a scan.
+* @param k the scan number
+* @param odometry receives the timestamp in microseconds and the left and right wheel odometry
+*/
+void getOdometry(int k, long * odometry);
+
+/**
+* Gets the ranges of a scan.  When the log holds 32-bit ranges and the host is little-endian, they
+* are returned in place, with no copying; changing them changes only this process's copy of the log.
+* @param k the scan number
+* @param scan_mm a buffer of getLaser() scan_size values, which receives ranges that need copying
+* @return the ranges in millimeters: scan_mm, or a pointer into the log, valid until it is closed
+*/
+int * getScan(int k, int * scan_mm);
+
+private:
+
+    ScanLog(void);
+
+    // In the byte order of this host
+    scanlog_header_t header;
+
+    char * records;
+
+    void * data;
+    size_t data_bytes;
+    bool mapped;
+};
@@ -0,0 +1,189 @@
+/**
+*
+* ScanStream.cpp - C++ code for streaming Lidar scans and odometry from a logfile
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ScanStream.hpp"
+
+// Arbitrary maximum length of line in input logfile
+#define MAXLINE 10000
+
+// Fields are parsed in place rather than with strtok, which keeps its state in a global
+
+static void skipfield(char ** cpp)
+{
+    while (**cpp == ' ')
+    {
+        ++*cpp;
+    }
+
+    while (**cpp && **cpp != ' ')
+    {
+        ++*cpp;
+    }
+}
+
+static long nextlong(char ** cpp)
+{
+    return strtol(*cpp, cpp, 10);
+}
+
+ScanStream * ScanStream::open(const char * filename, int scan_size, int nbuffers)
+{
+    FILE * fp = fopen(filename, "rt");
+
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    return new ScanStream(fp, scan_size, nbuffers);
+}
+
+ScanStream::ScanStream(FILE * fp, int scan_size, int nbuffers) :
+scans(nbuffers * scan_size),
+odometries(nbuffers * 3),
+ends(nbuffers)
+{
+    this->fp = fp;
+    this->scan_size = scan_size;
+    this->nbuffers = nbuffers;
+
+    fseek(fp, 0, SEEK_END);
+    this->file_bytes = ftell(fp);
+    rewind(fp);
+
+    this->end = 0;
+
+    this->produced = 0;
+    this->consumed = 0;
+    this->holding = false;
+    this->done = false;
+    this->stopping = false;
+
+    this->parser = thread(&ScanStream::parse, this);
+}
+
+ScanStream::~ScanStream(void)
+{
+    {
+        unique_lock<mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->buffer_free.notify_one();
+
+    this->parser.join();
+
+    fclose(this->fp);
+}
+
+double ScanStream::progress(void)
+{
+    unique_lock<mutex> guard(this->lock);
+
+    return this->file_bytes > 0 ? (double)this->end / this->file_bytes : 1;
+}
+
+void ScanStream::parse(void)
+{
+    char * s = new char [MAXLINE];
+
+    while (fgets(s, MAXLINE, this->fp))
+    {
+        // Wait for a free buffer
+        {
+            unique_lock<mutex> guard(this->lock);
+            this->buffer_free.wait(guard, [this]{ return this->stopping || this->produced - this->consumed < this->nbuffers; });
+
+            if (this->stopping)
+            {
+                break;
+            }
+        }
+
+        // Only this thread touches the buffer until it is produced; a last line with no newline
+        // still holds a scan
+        int slot = this->produced % this->nbuffers;
+        this->ends[slot] = ftell(this->fp);
+        int * scanvals = &this->scans[slot * this->scan_size];
+        long * odometry = &this->odometries[slot * 3];
+
+        char * cp = s;
+
+        odometry[0] = nextlong(&cp);
+        skipfield(&cp);
+        odometry[1] = nextlong(&cp);
+        odometry[2] = nextlong(&cp);
+
+        // Skip unused fields
+        for (int k=0; k<20; ++k)
+        {
+            skipfield(&cp);
+        }
+
+        for (int k=0; k<this->scan_size; ++k)
+        {
+            scanvals[k] = nextlong(&cp);
+        }
+
+        {
+            unique_lock<mutex> guard(this->lock);
+            ++this->produced;
+        }
+        this->scan_ready.notify_one();
+    }
+
+    {
+        unique_lock<mutex> guard(this->lock);
+        this->done = true;
+    }
+    this->scan_ready.notify_one();
+
+    delete [] s;
+}
+
+bool ScanStream::next(int * & scan_mm, long * & odometry)
+{
+    unique_lock<mutex> guard(this->lock);
+
+    // Give back the buffer from the last call
+    if (this->holding)
+    {
+        ++this->consumed;
+        this->holding = false;
+        this->buffer_free.notify_one();
+    }
+
+    this->scan_ready.wait(guard, [this]{ return this->done || this->produced > this->consumed; });
+
+    if (this->produced == this->consumed)
+    {
+        return false;
+    }
+
+    int slot = this->consumed % this->nbuffers;
+    scan_mm = &this->scans[slot * this->scan_size];
+    odometry = &this->odometries[slot * 3];
+    this->end = this->ends[slot];
+    this->holding = true;
+
+    return true;
+}
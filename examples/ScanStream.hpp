@@ -0,0 +1,104 @@
+/**
+*
+* ScanStream.hpp - header for streaming Lidar scans and odometry from a logfile
+*
+* Copyright (C) 2014 Simon D. Levy
+
+* This code is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation, either version 3 of the
+* License, or (at your option) any later version.
+*
+* This code is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+/**
+* Streams the scans of a logfile from Paris Mines Tech (e.g. exp2.dat), whose lines hold
+* <pre>
+*  TIMESTAMP  ... Q1  Q2 ... Distances
+*  (usec)                    (mm)
+*  0          ... 2   3  ... 24 ...
+* </pre>
+* where Q1, Q2 are odometry values.  A thread parses the file ahead of the reader into a fixed
+* ring of buffers, which are reused as the reader moves on, so parsing overlaps with whatever
+* the reader does with each scan, and memory does not grow with the length of the log.
+*/
+class ScanStream
+{
+public:
+
+/**
+* Opens a logfile and starts parsing it.
+* @param filename name of the file
+* @param scan_size number of distances per scan
+* @param nbuffers number of scans parsed ahead of the reader
+* @return a new ScanStream object, or NULL if the file cannot be opened
+*/
+static ScanStream * open(const char * filename, int scan_size, int nbuffers);
+
+/**
+* Stops parsing and closes the file.
+*/
+~ScanStream(void);
+
+/**
+* Returns how far through the file the scans handed out by next() reach, from 0 to 1, for
+* reporting progress; the file is not read ahead to count its scans.
+*/
+double progress(void);
+
+/**
+* Waits for the next scan, and hands back the buffer that holds it.  The buffer is valid until
+* the next call, when it is given back for reuse.
+* @param scan_mm receives the distances in millimeters
+* @param odometry receives the timestamp in microseconds and the two odometry values
+* @return true, or false at the end of the file
+*/
+bool next(int * & scan_mm, long * & odometry);
+
+private:
+
+    ScanStream(FILE * fp, int scan_size, int nbuffers);
+
+    void parse(void);
+
+    FILE * fp;
+    int scan_size;
+    long file_bytes;
+
+    int nbuffers;
+    vector<int> scans;
+    vector<long> odometries;
+
+    // Offset in the file of the end of the line of each scan, and of the scan held by the reader
+    vector<long> ends;
+    long end;
+
+    // Scans parsed and given back so far; the reader holds scan number <tt>consumed</tt>
+    // when <tt>holding</tt> is set
+    long produced;
+    long consumed;
+    bool holding;
+    bool done;
+    bool stopping;
+
+    mutex lock;
+    condition_variable scan_ready;
+    condition_variable buffer_free;
+
+    thread parser;
+};
@@ -0,0 +1,163 @@
+/*
+dat2log.cpp : Converts a logfile of odometry and scan data from Paris Mines Tech
+(e.g. exp2.dat) to a binary scan log (exp2.bzlog) that log2pgm can map into memory
+instead of parsing.  See ScanLog.hpp for the format.
+
+Copyright (C) 2014 Simon D. Levy
+
+This code is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this code.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Parameters of the Mines URG-04LX Lidar, which are not in the logfile
+static const int    SCAN_SIZE                   = 682;
+static const double SCAN_RATE_HZ                = 10;
+static const double DETECTION_ANGLE_DEGREES     = 240;
+static const double DISTANCE_NO_DETECTION_MM    = 4000;
+static const int    DETECTION_MARGIN            = 70;
+static const double OFFSET_MM                   = 145;
+
+// Number of scans parsed ahead of the conversion
+static const int STREAM_BUFFERS             = 16;
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ScanLog.hpp"
+#include "ScanStream.hpp"
+
+int main(int argc, const char ** argv)
+{
+    // Bozo filter for input args
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage:   %s <dataset> [range_bits]\n", argv[0]);
+        fprintf(stderr, "Example: %s exp2\n", argv[0]);
+        fprintf(stderr, "Ranges are stored in 16 bits if they fit, unless range_bits is 32,\n"
+                        "which lets log2pgm use them in place.\n");
+        exit(1);
+    }
+
+    const char * dataset = argv[1];
+    int range_bytes = (argc > 2 && atoi(argv[2]) == 32) ? 4 : 2;
+
+    char infilename[256];
+    sprintf(infilename, "%s.dat", dataset);
+
+    char outfilename[256];
+    sprintf(outfilename, "%s.bzlog", dataset);
+
+    ScanStream * stream = ScanStream::open(infilename, SCAN_SIZE, STREAM_BUFFERS);
+
+    if (!stream)
+    {
+        fprintf(stderr, "Failed to open file %s\n", infilename);
+        exit(1);
+    }
+
+    int * scanvals = NULL;
+    long * odometry = NULL;
+
+    // First pass: count the scans, and see whether their ranges fit in 16 bits
+    uint64_t nrecords = 0;
+    while (stream->next(scanvals, odometry))
+    {
+        for (int k=0; k<SCAN_SIZE; ++k)
+        {
+            if (scanvals[k] < 0 || scanvals[k] > 0xFFFF)
+            {
+                range_bytes = 4;
+            }
+        }
+
+        ++nrecords;
+    }
+
+    delete stream;
+
+    // Write the header, padded to its full size
+    FILE * outfp = fopen(outfilename, "wb");
+
+    if (!outfp)
+    {
+        fprintf(stderr, "Failed to open file %s\n", outfilename);
+        exit(1);
+    }
+
+    char * headerbytes = (char *)calloc(SCANLOG_HEADER_BYTES, 1);
+    scanlog_header_t * header = (scanlog_header_t *)headerbytes;
+    memcpy(header->magic, SCANLOG_MAGIC, sizeof(SCANLOG_MAGIC));
+    header->format_version = SCANLOG_VERSION;
+    header->header_bytes = SCANLOG_HEADER_BYTES;
+    header->record_bytes = scanlog_record_bytes(SCAN_SIZE, range_bytes);
+    header->range_bytes = range_bytes;
+    header->nrecords = nrecords;
+    header->scan_size = SCAN_SIZE;
+    header->detection_margin = DETECTION_MARGIN;
+    header->scan_rate_hz = SCAN_RATE_HZ;
+    header->detection_angle_degrees = DETECTION_ANGLE_DEGREES;
+    header->distance_no_detection_mm = DISTANCE_NO_DETECTION_MM;
+    header->offset_mm = OFFSET_MM;
+
+    uint32_t record_bytes = header->record_bytes;
+
+    scanlog_header_byte_order(header);
+    fwrite(headerbytes, 1, SCANLOG_HEADER_BYTES, outfp);
+
+    // Second pass: write a record per scan
+    char * record = (char *)calloc(record_bytes, 1);
+    stream = ScanStream::open(infilename, SCAN_SIZE, STREAM_BUFFERS);
+
+    while (stream->next(scanvals, odometry))
+    {
+        int64_t timestamp_usec = odometry[0];
+        int32_t wheels[2] = {(int32_t)odometry[1], (int32_t)odometry[2]};
+        scanlog_byte_order(&timestamp_usec, sizeof(timestamp_usec), 1);
+        scanlog_byte_order(wheels, sizeof(int32_t), 2);
+        memcpy(record, &timestamp_usec, sizeof(timestamp_usec));
+        memcpy(record + sizeof(timestamp_usec), wheels, sizeof(wheels));
+
+        char * ranges = record + sizeof(timestamp_usec) + sizeof(wheels);
+
+        for (int k=0; k<SCAN_SIZE; ++k)
+        {
+            if (range_bytes == 2)
+            {
+                ((uint16_t *)ranges)[k] = scanvals[k];
+            }
+            else
+            {
+                ((int32_t *)ranges)[k] = scanvals[k];
+            }
+        }
+
+        scanlog_byte_order(ranges, range_bytes, SCAN_SIZE);
+
+        fwrite(record, 1, record_bytes, outfp);
+    }
+
+    if (fclose(outfp))
+    {
+        fprintf(stderr, "Failed to write file %s\n", outfilename);
+        exit(1);
+    }
+
+    printf("Wrote %d scans with %d-bit ranges to %s\n", (int)nrecords, 8*range_bytes, outfilename);
+
+    delete stream;
+    free(record);
+    free(headerbytes);
+
+    return 0;
+}
@@ -42,8 +42,8 @@ static const double MAP_SIZE_METERS     =  32;
 
 static const int SCAN_SIZE 		        = 682;
 
-// Arbitrary maximum length of line in input logfile
-#define MAXLINE 10000
+// Number of scans parsed ahead of SLAM when streaming a text logfile
+static const int STREAM_BUFFERS         = 16;
 
 #include <iostream>
 #include <vector>
@@ -60,80 +60,10 @@ using namespace std;
 #include "WheeledRobot.hpp"
 #include "PoseChange.hpp"
 #include "algorithms.hpp"
+#include "ScanLog.hpp"
+#include "ScanStream.hpp"
 
 
-// Methods to load all data from file ------------------------------------------
-// Each line in the file has the format:
-//
-//  TIMESTAMP  ... Q1  Q1 ... Distances
-//  (usec)                    (mm)
-//  0          ... 2   3  ... 24 ... 
-//  
-//where Q1, Q2 are odometry values
-
-static void skiptok(char ** cpp)
-{
-    *cpp = strtok(NULL, " ");
-}
-
-static int nextint(char ** cpp)
-{
-    skiptok(cpp);
-    
-    return atoi(*cpp);
-}
-
-static void load_data(
-    const char * dataset, 
-    vector<int *> & scans,
-    vector<long *> & odometries)
-{
-    char filename[256];
-    
-    sprintf(filename, "%s.dat", dataset);
-    printf("Loading data from %s ... \n", filename);
-    
-    FILE * fp = fopen(filename, "rt");
-    
-    if (!fp)
-    {
-        fprintf(stderr, "Failed to open file\n");
-        exit(1);
-    }
-    
-    char s[MAXLINE];
-    
-    while (fgets(s, MAXLINE, fp))
-    {
-        char * cp = strtok(s, " ");
-               
-        long * odometry = new long [3];
-        odometry[0] = atol(cp);
-        skiptok(&cp);        
-        odometry[1] = nextint(&cp);
-        odometry[2] = nextint(&cp);
-        
-        odometries.push_back(odometry);
-        
-        // Skip unused fields
-        for (int k=0; k<20; ++k)
-        {
-            skiptok(&cp);
-        }
-        
-        int * scanvals = new int [SCAN_SIZE];
-        
-        for (int k=0; k<SCAN_SIZE; ++k)
-        {
-            scanvals[k] = nextint(&cp);
-        }
-        
-        scans.push_back(scanvals);
-    }
-    
-    fclose(fp);    
-}
-
 // Class for Mines verison of URG-04LX Lidar -----------------------------------
 
 class MinesURG04LX : public URG04LX
@@ -316,10 +246,31 @@ int main( int argc, const char** argv )
     bool use_odometry    =  atoi(argv[2]) ? true : false;
     int random_seed =  argc > 3 ? atoi(argv[3]) : 0;
     
-    // Load the Lidar and odometry data from the file   
-    vector<int *> scans;
-    vector<long *> odometries;
-    load_data(dataset, scans, odometries);
+    // Map the binary log (see dat2log) into memory if there is one; otherwise stream the
+    // Lidar and odometry data from the text file, parsing it on another thread
+    char logname[256];
+    sprintf(logname, "%s.bzlog", dataset);
+    ScanLog * log = ScanLog::open(logname);
+    ScanStream * stream = NULL;
+    
+    if (log)
+    {
+        printf("Mapping data from %s ... \n", logname);
+    }
+    else
+    {
+        char filename[256];
+        sprintf(filename, "%s.dat", dataset);
+        printf("Streaming data from %s ... \n", filename);
+        
+        stream = ScanStream::open(filename, SCAN_SIZE, STREAM_BUFFERS);
+        
+        if (!stream)
+        {
+            fprintf(stderr, "Failed to open file\n");
+            exit(1);
+        }
+    }
        
     // Build a robot model in case we want odometry
     Rover robot = Rover();
@@ -328,32 +279,45 @@ int main( int argc, const char** argv )
     unsigned char * mapbytes = new unsigned char[MAP_SIZE_PIXELS * MAP_SIZE_PIXELS];
         
     // Create SLAM object
-    MinesURG04LX laser;
+    Laser laser = log ? log->getLaser() : MinesURG04LX();
     SinglePositionSLAM * slam = random_seed ?
     (SinglePositionSLAM*)new RMHC_SLAM(laser, MAP_SIZE_PIXELS, MAP_SIZE_METERS, random_seed) :
     (SinglePositionSLAM*)new Deterministic_SLAM(laser, MAP_SIZE_PIXELS, MAP_SIZE_METERS);
 	    
-    // Report what we're doing
-    int nscans = scans.size();
-    printf("Processing %d scans with%s odometry / with%s particle filter...\n",
-        nscans, use_odometry ? "" : "out", random_seed ? "" : "out");
-    ProgressBar * progbar = new ProgressBar(0, nscans, 80); 
+    // Report what we're doing; a stream is not counted ahead, so its progress is through the file
+    int nscans = log ? log->size() : 0;
+    printf("Processing scans with%s odometry / with%s particle filter...\n",
+        use_odometry ? "" : "out", random_seed ? "" : "out");
+    ProgressBar * progbar = new ProgressBar(0, 1000, 80); 
         
-    // Start with an empty trajectory of positions
-    vector<double *> trajectory;
+    // Start with an empty trajectory, as a mask of the pixels visited
+    vector<bool> trajectory(MAP_SIZE_PIXELS * MAP_SIZE_PIXELS);
     
     // Start timing
     time_t start_sec = time(NULL);
 
     // Loop over scans
-    for (int scanno=0; scanno<nscans; ++scanno)
+    vector<int> scanbuf(log ? log->getScanSize() : 0);
+    long logodometry[3];
+    int scanno = 0;
+    for (scanno=0; !log || scanno<nscans; ++scanno)
     {                         
-        int * lidar = scans[scanno];
+        int * lidar = NULL;
+        long * o = logodometry;
+        
+        if (log)
+        {
+            lidar = log->getScan(scanno, &scanbuf[0]);
+            log->getOdometry(scanno, logodometry);
+        }
+        else if (!stream->next(lidar, o))
+        {
+            break;
+        }
         
         // Update with/out odometry
         if (use_odometry)
         {
-            long * o = odometries[scanno];
             PoseChange poseChange = robot.computePoseChange(o[0], o[1], o[2]);
             slam->update(lidar, poseChange);            
         }
@@ -365,18 +329,16 @@ int main( int argc, const char** argv )
         Position position = slam->getpos();
 
         // Add new coordinates to trajectory
-        double * v = new double[2];
-        v[0] = position.x_mm;
-        v[1] = position.y_mm;
-        trajectory.push_back(v);     
+        trajectory[coords2index(mm2pix(position.x_mm), mm2pix(position.y_mm))] = true;
         
         // Tame impatience
-        progbar->updateAmount(scanno);
+        progbar->updateAmount(log ? (int)(1000. * (scanno+1) / nscans) : (int)(1000 * stream->progress()));
         printf("\r%s", progbar->str());
         fflush(stdout);
     }
 
     // Report speed
+    nscans = scanno;
     time_t elapsed_sec = time(NULL) - start_sec;
     printf("\n%d scans in %ld seconds = %f scans / sec\n", 
            nscans, elapsed_sec, (float)nscans/elapsed_sec);
@@ -387,14 +349,10 @@ int main( int argc, const char** argv )
     // Put trajectory into map as black pixels
     for (int k=0; k<(int)trajectory.size(); ++k)
     {        
-        double * v = trajectory[k];
-                        
-        int x = mm2pix(v[0]);
-        int y = mm2pix(v[1]);
-        
-        delete v;
-                        
-        mapbytes[coords2index(x, y)] = 0;
+        if (trajectory[k])
+        {
+            mapbytes[k] = 0;
+        }
     }
             
     // Save map and trajectory as PGM file    
@@ -419,12 +377,6 @@ int main( int argc, const char** argv )
     printf("\n");
     
     // Clean up
-    for (int scanno=0; scanno<(int)scans.size(); ++scanno)
-    {                                       
-        delete scans[scanno];
-        delete odometries[scanno];
-    }
-    
     if (random_seed)
     {
         delete ((RMHC_SLAM *)slam);
@@ -434,6 +386,8 @@ int main( int argc, const char** argv )
         delete ((Deterministic_SLAM *)slam);
     }
 
+    delete log;
+    delete stream;
     delete progbar;
     delete mapbytes;
     fclose(output);
@@ -23,6 +23,7 @@ import pybreezyslam
 
 import math
 import time
+import collections
 
 # Basic params
 _DEFAULT_MAP_QUALITY         = 50 # out of 255
@@ -33,6 +34,48 @@ _DEFAULT_SIGMA_XY_MM         = 100
 _DEFAULT_SIGMA_THETA_DEGREES = 20
 _DEFAULT_MAX_SEARCH_ITER     = 1000
 
+# Number of most recent updates kept by CoreSLAM.getStats()
+_STATS_WINDOW                = 1000
+
+# Monotonic clock for timing the stages of CoreSLAM.update()
+_clock = getattr(time, 'perf_counter', time.time)
+
+class _UpdateStats(object):
+    '''
+    Rolling statistics of the stages of CoreSLAM.update(), over its most recent calls
+    '''
+    
+    def __init__(self):
+        
+        self.samples = collections.OrderedDict()
+        
+    def add(self, name, value):
+        
+        if not name in self.samples:
+            self.samples[name] = collections.deque(maxlen=_STATS_WINDOW)
+            
+        self.samples[name].append(value)
+        
+    def addTime(self, name, start):
+        
+        self.add(name, (_clock() - start) * 1e6)
+        
+    def summary(self):
+        
+        stats = {}
+        
+        for name, samples in self.samples.items():
+            ordered = sorted(samples)
+            count = len(ordered)
+            stats[name] = {
+                'count' : count,
+                'min'   : ordered[0],
+                'mean'  : sum(ordered) / float(count),
+                'p99'   : ordered[max(int(math.ceil(0.99 * count)) - 1, 0)],
+                'max'   : ordered[-1]}
+            
+        return stats
+
 # CoreSLAM class ------------------------------------------------------------------------------------------------------
 
 class CoreSLAM(object):
@@ -83,6 +126,9 @@ class CoreSLAM(object):
                 
         # Initialize the map 
         self.map = pybreezyslam.Map(map_size_pixels, map_size_meters)
+        
+        # Keep statistics of updates if the extension counts the work of search
+        self._stats = _UpdateStats() if pybreezyslam.searchStats() != None else None
                 
     def update(self, scans_mm, pose_change, scan_angles_degrees=None, should_update_map=True):
         '''
@@ -102,13 +148,30 @@ class CoreSLAM(object):
         dtheta_degrees_dt = pose_change[1] * velocity_factor
         velocities = (dxy_mm_dt, dtheta_degrees_dt)
 
-        # Build a scan for computing distance to map, and one for updating map 
-        self._scan_update(self.scan_for_mapbuild, scans_mm, velocities, scan_angles_degrees)
-        self._scan_update(self.scan_for_distance, scans_mm, velocities, scan_angles_degrees)
+        start = _clock()
+
+        # Build a scan for computing distance to map, and one for updating map, in one pass
+        self._scan_update(self.scan_for_mapbuild, scans_mm, velocities, scan_angles_degrees, self.scan_for_distance)
+        
+        if self._stats:
+            self._stats.addTime('scan_update', start)
 
         # Implementing class updates map and pointcloud
         self._updateMapAndPointcloud(pose_change[0], pose_change[1], should_update_map)
         
+        if self._stats:
+            self._stats.addTime('update', start)
+            
+    def getStats(self):
+        '''
+        Returns rolling statistics of the most recent 1000 updates, as a dictionary mapping 'scan_update', 
+        'position_search', 'map_update', and 'update' to their times in microseconds, and 'search_iterations', 
+        'search_accepted', 'search_rejected', 'points_scored', and 'search_cache_hits' to the work done by RMHC 
+        search, each as a dictionary with keys 'count', 'min', 'mean', 'p99', and 'max'.  The dictionary is empty unless the
+        extension was built with BREEZYSLAM_STATS set in the environment.
+        '''
+        return self._stats.summary() if self._stats else {}
+        
     def getmap(self, mapbytes):
         '''
         Fills bytearray mapbytes with current map pixels, where bytearray length is square of map size passed
@@ -116,6 +179,13 @@ class CoreSLAM(object):
         '''
         self.map.get(mapbytes)
         
+    def getmapTiles(self, since_version=0):
+        '''
+        Returns (version, tiles, mapbytes) for the parts of the map changed since it had since_version 
+        (0 for the whole map), where tiles lists the numbers of the changed 64x64-pixel tiles, row by row,
+        and mapbytes holds their pixels one tile after another.  Pass version as since_version next time.
+        '''
+        return self.map.getTiles(since_version)
         
     def setmap(self, mapbytes):
         '''
@@ -134,10 +204,10 @@ class CoreSLAM(object):
          return self.__str__()
 
         
-    def _scan_update(self, scan, scans_distances_mm, velocities, scan_angles_degrees):
+    def _scan_update(self, scan, scans_distances_mm, velocities, scan_angles_degrees, other_scan=None):
 
         scan.update(scans_mm=scans_distances_mm, hole_width_mm=self.hole_width_mm, 
-                velocities=velocities, scan_angles_degrees=scan_angles_degrees)
+                velocities=velocities, scan_angles_degrees=scan_angles_degrees, other_scan=other_scan)
         
         
 # SinglePositionSLAM class ---------------------------------------------------------------------------------------------
@@ -181,7 +251,11 @@ class SinglePositionSLAM(CoreSLAM):
         start_pos.y_mm  += self.laser.offset_mm * self._sintheta()
 
         # Get new position from implementing class
+        start = _clock()
         new_position = self._getNewPosition(start_pos)
+        
+        if self._stats:
+            self._stats.addTime('position_search', start)
                 
         # Update the current position with this new position, adjusted by laser offset
         self.position = new_position.copy()        
@@ -190,7 +264,11 @@ class SinglePositionSLAM(CoreSLAM):
   
         # Update the map with this new position if indicated
         if should_update_map:
+            start = _clock()
             self.map.update(self.scan_for_mapbuild, new_position, self.map_quality, self.hole_width_mm)
+            
+            if self._stats:
+                self._stats.addTime('map_update', start)
       
     def getpos(self):
         '''
@@ -265,7 +343,7 @@ class RMHC_SLAM(SinglePositionSLAM):
         '''     
         
         # RMHC search is implemented as a C extension for efficiency
-        return pybreezyslam.rmhcPositionSearch(
+        new_position = pybreezyslam.rmhcPositionSearch(
             start_position, 
             self.map, 
             self.scan_for_distance, 
@@ -274,6 +352,12 @@ class RMHC_SLAM(SinglePositionSLAM):
             self.sigma_theta_degrees,
             self.max_search_iter,
             self.randomizer)
+            
+        if self._stats:
+            for name, count in pybreezyslam.searchStats().items():
+                self._stats.add(name, count)
+                
+        return new_position
                              
     def _random_normal(self, mu, sigma):
         
@@ -272,18 +272,32 @@ Scan_update(Scan *self, PyObject *args, PyObject *kwds)
     double hole_width_mm = 0;
     PyObject * py_velocities = NULL;
     PyObject * py_scan_angles_degrees = NULL;
+    PyObject * py_other_scan = Py_None;
 
-    static char* argnames[] = {"scans_mm", "hole_width_mm", "velocities", "scan_angles_degrees", NULL};
+    static char* argnames[] = {"scans_mm", "hole_width_mm", "velocities", "scan_angles_degrees", 
+                               "other_scan", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds,"Od|OO", argnames,
+    if (!PyArg_ParseTupleAndKeywords(args, kwds,"Od|OOO", argnames,
         &py_lidar, 
         &hole_width_mm,
         &py_velocities,
-        &py_scan_angles_degrees))
+        &py_scan_angles_degrees,
+        &py_other_scan))
     {
         return null_on_raise_argument_exception("Scan", "update");
     }
 
+    // Bozo filter on other scan: must be a Scan for the same laser
+    if (py_other_scan != Py_None)
+    {
+        if (!PyObject_TypeCheck(py_other_scan, Py_TYPE(self)) ||
+            ((Scan *)py_other_scan)->scan.size != self->scan.size)
+        {
+            return null_on_raise_argument_exception_with_details("Scan", "update", 
+                    "other scan must be a Scan for the same laser");
+        }
+    }
+
     // Bozo filter on LIDAR argument
     if (!PyList_Check(py_lidar))
     {
@@ -350,9 +364,18 @@ Scan_update(Scan *self, PyObject *args, PyObject *kwds)
         self->lidar_distances_mm[k] = (int)PyFloat_AsDouble(PyList_GetItem(py_lidar, k));
     }
 
-    // Update the scan
-    scan_update(
-            &self->scan, 
+    // Update the scan, and the other scan in the same pass
+    scan_t * scans[2] = {&self->scan, NULL};
+    int nscans = 1;
+
+    if (py_other_scan != Py_None)
+    {
+        scans[nscans++] = &((Scan *)py_other_scan)->scan;
+    }
+
+    scan_update_multiple(
+            scans,
+            nscans,
             (py_scan_angles_degrees != Py_None) ? self->lidar_angles_deg :NULL,
             self->lidar_distances_mm, 
             PyList_Size(py_lidar),
@@ -372,7 +395,9 @@ static PyMethodDef Scan_methods[] =
             "scans_mm is a list of integers representing scanned distances in mm.\n"\
             "hole_width_mm is the width of holes (obstacles, walls) in millimeters.\n"\
             "velocities is an optional tuple containing (dxy_mm/dt, dtheta_degrees/dt);\n"\
-            "i.e., robot's (forward, rotational velocity) for improving the quality of the scan."
+            "i.e., robot's (forward, rotational velocity) for improving the quality of the scan.\n"\
+            "other_scan is an optional Scan for the same laser (e.g. with a different span)\n"\
+            "to update from the same values in the same pass."
     },
     {NULL}  // Sentinel 
 };
@@ -484,18 +509,27 @@ Map_init(Map *self, PyObject *args, PyObject *kwds)
 	int size_pixels;
 	double size_meters;
 	PyObject * py_bytes = NULL;
+	int sparse = 0;
 	
-    static char * argnames[] = {"size_pixels", "size_meters", "bytes", NULL};
+    static char * argnames[] = {"size_pixels", "size_meters", "bytes", "sparse", NULL};
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwds,"id|O", argnames, 
+    if(!PyArg_ParseTupleAndKeywords(args, kwds,"id|Oi", argnames, 
         &size_pixels, 
         &size_meters, 
-        &py_bytes))
+        &py_bytes,
+        &sparse))
     {
         return error_on_raise_argument_exception("Map");
     }
-           
-    map_init(&self->map, size_pixels, size_meters);
+    
+    if (sparse)
+    {
+        map_init_sparse(&self->map, size_pixels, size_meters);
+    }
+    else
+    {
+        map_init(&self->map, size_pixels, size_meters);
+    }
     
     if (py_bytes && !bad_mapbytes(py_bytes, size_pixels, "__init__"))
     {    
@@ -557,6 +591,107 @@ Map_set(Map * self, PyObject * args, PyObject * kwds)
     Py_RETURN_NONE;
 }
 
+static PyObject *
+Map_getTiles(Map * self, PyObject * args, PyObject * kwds)
+{        
+    unsigned since_version = 0;
+
+    if (!PyArg_ParseTuple(args, "I", &since_version))
+    {
+        return null_on_raise_argument_exception("Map", "getTiles");
+    }
+    
+    int maxtiles = self->map.size_tiles * self->map.size_tiles;
+    
+    int * tiles = int_alloc(maxtiles);
+    char * bytes = (char *)malloc(maxtiles * MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS);
+    
+    int ntiles = map_get_tiles(&self->map, since_version, tiles, bytes);
+    
+    PyObject * py_tiles = PyList_New(ntiles);
+    int k = 0;
+    for (k=0; k<ntiles; ++k)
+    {
+        PyList_SetItem(py_tiles, k, PyLong_FromLong(tiles[k]));
+    }
+    
+    PyObject * py_bytes = 
+        PyByteArray_FromStringAndSize(bytes, ntiles * MAP_TILE_SIZE_PIXELS * MAP_TILE_SIZE_PIXELS);
+    
+    free(tiles);
+    free(bytes);
+    
+    return Py_BuildValue("INN", self->map.version, py_tiles, py_bytes);
+}
+
+static PyObject *
+Map_save(Map * self, PyObject * args, PyObject * kwds)
+{        
+    const char * filename = NULL;
+
+    if (!PyArg_ParseTuple(args, "s", &filename))
+    {
+        return null_on_raise_argument_exception("Map", "save");
+    }
+    
+    if (map_save(&self->map, filename))
+    {
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+    }
+    
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Map_open(PyTypeObject * type, PyObject * args, PyObject * kwds)
+{        
+    const char * filename = NULL;
+    const char * modename = "copy";
+
+    static char * argnames[] = {"filename", "mode", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds,"s|s", argnames, 
+        &filename, 
+        &modename))
+    {
+        return null_on_raise_argument_exception("Map", "open");
+    }
+    
+    int mode = 0;
+    
+    if (!strcmp(modename, "copy"))
+    {
+        mode = MAP_OPEN_COPY;
+    }
+    else if (!strcmp(modename, "r"))
+    {
+        mode = MAP_OPEN_READ_ONLY;
+    }
+    else if (!strcmp(modename, "c"))
+    {
+        mode = MAP_OPEN_COPY_ON_WRITE;
+    }
+    else
+    {
+        error_on_raise_argument_exception_with_details("Map", "open", 
+            "mode must be 'copy', 'r', or 'c'");
+        return NULL;
+    }
+    
+    Map * self = (Map *)type->tp_alloc(type, 0);
+    
+    if (self && map_open(&self->map, filename, mode))
+    {
+        // Nothing to free in the map, so skip Map_dealloc
+        Py_TYPE(self)->tp_free((PyObject*)self);
+        
+        PyErr_Format(PyExc_IOError, "Cannot open map file %s", filename);
+        return NULL;
+    }
+    
+    return (PyObject *)self;
+}
+
 static PyObject *
 Map_update(Map *self, PyObject *args, PyObject *kwds)
 {   
@@ -607,12 +742,28 @@ static PyMethodDef Map_methods[] =
     {"set", (PyCFunction)Map_set, METH_VARARGS,
     "Map.set(bytearray) fills current map with pixels in bytearray, where bytearray length is square of size of map."
     },
+    {"getTiles", (PyCFunction)Map_getTiles, METH_VARARGS,
+    "Map.getTiles(since_version) returns (version, tiles, bytearray) for the 64x64-pixel tiles changed since\n"\
+    "the map had since_version (0 for all tiles): tiles lists the tile numbers, row by row, and bytearray\n"\
+    "holds their pixels as Map.get would, one tile after another, with zeros beyond the edge of the map.\n"\
+    "Pass version as since_version next time to get only the newer changes."
+    },
+    {"save", (PyCFunction)Map_save, METH_VARARGS,
+    "Map.save(filename) saves the map to a file that Map.open can map straight into memory."
+    },
+    {"open", (PyCFunction)Map_open, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+    "Map.open(filename, mode='copy') returns a new map with the pixels saved by Map.save.\n"\
+    "mode 'copy' reads them into memory; 'r' maps the file read-only, so that processes opening the\n"\
+    "same file share its pixels and the map cannot be updated; 'c' maps it copy-on-write, so that\n"\
+    "updates change the map but not the file.  The mapping modes take no time to load."
+    },
     {NULL}  // Sentinel 
 };
 
 #define TP_DOC_MAP \
 "A class for maps used in SLAM.\n"\
-"Map.__init__(size_pixels, size_meters, bytes=None)"
+"Map.__init__(size_pixels, size_meters, bytes=None, sparse=False)\n"\
+"A sparse map allocates each 64x64-pixel tile only when it is first written."
 
 
 static PyTypeObject pybreezyslam_MapType = 
@@ -847,6 +998,24 @@ rmhcPositionSearch(PyObject *self, PyObject *args)
 }
 
 
+static PyObject *
+searchStats(PyObject *self, PyObject *args)
+{
+    search_stats_t stats;
+    
+    if (search_stats_take(&stats))
+    {
+        Py_RETURN_NONE;
+    }
+    
+    return Py_BuildValue("{s:l,s:l,s:l,s:l,s:l}", 
+        "search_iterations", stats.iterations,
+        "search_accepted", stats.accepted,
+        "search_rejected", stats.rejected,
+        "points_scored", stats.points,
+        "search_cache_hits", stats.cache_hits);
+}
+
 static PyMethodDef module_methods[] = 
 {
     {"distanceScanToMap", distanceScanToMap, METH_VARARGS,
@@ -861,6 +1030,11 @@ static PyMethodDef module_methods[] =
         "rmhcPositionSearch(startpos, map, scan, laser, sigma_xy_mm, max_iter, randomizer)\n"
     "Internal use only."
     },
+    {"searchStats", searchStats, METH_NOARGS,
+        "searchStats() returns the work done by rmhcPositionSearch since the last call, as a dictionary\n"
+        "of counts, or None if not built with BREEZYSLAM_STATS.\n"
+    "Internal use only."
+    },
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
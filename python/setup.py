@@ -19,33 +19,40 @@ You should have received a copy of the GNU Lesser General Public License
 along with this code.  If not, see <http://www.gnu.org/licenses/>.
 '''
 
-# Support streaming SIMD extensions
+# Support streaming SIMD extensions.  All kernels for the architecture are
+# compiled in, and the fastest one the CPU supports is picked at run time.
 
 from platform import machine
+from os import environ
 
 OPT_FLAGS  = []
 SIMD_FLAGS = []
+MAP_FLAGS  = []
 
 arch = machine()
 
 print(arch)
 
-if  arch in ['i686', 'x86_64']:
-    SIMD_FLAGS = ['-msse3']
-    arch = 'i686'
-
-elif arch == 'armv7l':
+if arch == 'armv7l':
     OPT_FLAGS = ['-O3']
     SIMD_FLAGS = ['-mfpu=neon']
 
-else:
-    arch = 'sisd'
+# Set BREEZYSLAM_MAP8=1 to store map pixels in 8 bits rather than 16
+if environ.get('BREEZYSLAM_MAP8'):
+    MAP_FLAGS = ['-DBREEZYSLAM_MAP8']
+
+# Set BREEZYSLAM_STATS to gather the statistics returned by CoreSLAM.getStats()
+if environ.get('BREEZYSLAM_STATS'):
+    MAP_FLAGS += ['-DBREEZYSLAM_STATS']
 
 SOURCES = [
     'pybreezyslam.c', 
     'pyextension_utils.c', 
     '../c/coreslam.c', 
-    '../c/coreslam_' + arch + '.c',
+    '../c/coreslam_sisd.c',
+    '../c/coreslam_i686.c',
+    '../c/coreslam_x86_64.c',
+    '../c/coreslam_armv7l.c',
     '../c/random.c',
     '../c/ziggurat.c']
 
@@ -53,7 +60,7 @@ from distutils.core import setup, Extension
 
 module = Extension('pybreezyslam', 
     sources = SOURCES, 
-    extra_compile_args = ['-std=gnu99'] + SIMD_FLAGS + OPT_FLAGS
+    extra_compile_args = ['-std=gnu99'] + SIMD_FLAGS + OPT_FLAGS + MAP_FLAGS
     )
 
 